@@ -33,22 +33,130 @@ impl Default for Relation {
     }
 }
 
+/// Minimum confidence of learned relation, weaker ones are forgotten.
+const MIN_CONFIDENCE: f32 = 0.05;
+/// Confidence kept by each decay.
+const DECAY_FACTOR: f32 = 0.9;
+/// Number of learned evidences between two decays.
+const DECAY_INTERVAL: usize = 512;
+
 /// Table of relation
+///
+/// Relations found by static analysis are certain and stored densely.
+/// Relations learned from progs carry a confidence in (0,1], which grows
+/// with each evidence and decays over time, so a table never saturates.
+/// Learned ones are sparse and stored in a map.
 #[derive(Debug, Clone)]
-pub struct RTable(Array2<Relation>);
+pub struct RTable {
+    statics: Array2<Relation>,
+    learned: HashMap<(usize, usize), f32>,
+    learn_cnt: usize,
+    /// Interfaces that are not disabled by probe.
+    enabled: Vec<bool>,
+}
+
+/// Learned relations of a table, for persisting across runs.
+#[derive(Debug, Clone, Default, Serialize, Deserialize)]
+pub struct LearnedRelations {
+    /// Number of interfaces of table.
+    pub fn_num: usize,
+    pub entries: Vec<(usize, usize, f32)>,
+}
 
 impl RTable {
     /// Crate new relation table for n interfaces, use default value for relation
     pub fn new(n: usize) -> Self {
-        RTable(Array2::default((n, n)))
+        RTable {
+            statics: Array2::default((n, n)),
+            learned: HashMap::new(),
+            learn_cnt: 0,
+            enabled: vec![true; n],
+        }
+    }
+
+    /// Disable interface i, return false if it's already disabled.
+    pub fn disable(&mut self, i: usize) -> bool {
+        std::mem::replace(&mut self.enabled[i], false)
+    }
+
+    #[inline]
+    pub fn is_enabled(&self, i: usize) -> bool {
+        self.enabled[i]
+    }
+
+    pub fn enabled_num(&self) -> usize {
+        self.enabled.iter().filter(|e| **e).count()
     }
 
     pub fn is_empty(&self) -> bool {
-        self.0.is_empty()
+        self.statics.is_empty()
     }
 
     pub fn len(&self) -> usize {
-        self.0.len_of(Axis(0))
+        self.statics.len_of(Axis(0))
+    }
+
+    /// Weight of relation that j has impact on i, 1.0 for static relation.
+    pub fn weight(&self, i: usize, j: usize) -> f64 {
+        if self.statics[(i, j)] == Relation::Some {
+            1.0
+        } else {
+            self.learned.get(&(i, j)).copied().unwrap_or(0.0) as f64
+        }
+    }
+
+    /// Add evidence in (0,1] that j has impact on i.
+    pub fn learn(&mut self, i: usize, j: usize, evidence: f32) {
+        if self.statics[(i, j)] == Relation::Some {
+            return;
+        }
+        let c = self.learned.entry((i, j)).or_insert(0.0);
+        *c += evidence * (1.0 - *c);
+
+        self.learn_cnt += 1;
+        if self.learn_cnt % DECAY_INTERVAL == 0 {
+            self.decay();
+        }
+    }
+
+    fn decay(&mut self) {
+        self.learned.retain(|_, c| {
+            *c *= DECAY_FACTOR;
+            *c >= MIN_CONFIDENCE
+        });
+    }
+
+    /// Number of learned relations.
+    pub fn learned_len(&self) -> usize {
+        self.learned.len()
+    }
+
+    pub fn dump_learned(&self) -> LearnedRelations {
+        let mut entries = self
+            .learned
+            .iter()
+            .map(|(&(i, j), &c)| (i, j, c))
+            .collect::<Vec<_>>();
+        entries.sort_unstable_by_key(|&(i, j, _)| (i, j));
+        LearnedRelations {
+            fn_num: self.len(),
+            entries,
+        }
+    }
+
+    /// Restore learned relations, return false if they're learned for another table.
+    pub fn restore_learned(&mut self, l: &LearnedRelations) -> bool {
+        let n = self.len();
+        if l.fn_num != n || l.entries.iter().any(|&(i, j, _)| i >= n || j >= n) {
+            return false;
+        }
+        self.learned = l
+            .entries
+            .iter()
+            .filter(|&&(_, _, c)| c >= MIN_CONFIDENCE)
+            .map(|&(i, j, c)| ((i, j), c.min(1.0)))
+            .collect();
+        true
     }
 }
 
@@ -56,19 +164,19 @@ impl Deref for RTable {
     type Target = Array2<Relation>;
 
     fn deref(&self) -> &Self::Target {
-        &self.0
+        &self.statics
     }
 }
 
 impl DerefMut for RTable {
     fn deref_mut(&mut self) -> &mut Self::Target {
-        &mut self.0
+        &mut self.statics
     }
 }
 
 impl Display for RTable {
     fn fmt(&self, f: &mut Formatter<'_>) -> Result<(), Error> {
-        write!(f, "{}", self.0)
+        write!(f, "{}", self.statics)
     }
 }
 
@@ -91,13 +199,10 @@ pub fn static_analyze(target: &Target) -> HashMap<GroupId, RTable> {
 }
 
 fn res_analyze(g: &Group, r: &mut RTable, t: &Target) {
-    let mut uses = HashMap::new();
-    g.iter_fn()
-        .enumerate()
-        .for_each(|(i, f)| res_use(i, f, t, &mut uses));
-    for u in uses.values() {
-        for &p in &u.producer {
-            for &c in &u.consumer {
+    let index = &t.res_index[&g.id];
+    for (producers, consumers) in index.producers.iter().zip(index.consumers.iter()) {
+        for &p in producers {
+            for &c in consumers {
                 if p != c {
                     r[(c, p)] = Relation::Some;
                 }
@@ -106,6 +211,55 @@ fn res_analyze(g: &Group, r: &mut RTable, t: &Target) {
     }
 }
 
+/// Producers and consumers of resources in a group
+///
+/// Fns are indexed by their position in group, resources by slot of
+/// their type, see `Target::res_slot_of`.
+#[derive(Debug, Default)]
+pub struct ResIndex {
+    /// Fns producing each resource, indexed by slot.
+    pub producers: Vec<Vec<usize>>,
+    /// Fns consuming each resource, indexed by slot.
+    pub consumers: Vec<Vec<usize>>,
+    /// Slots of resources each fn consumes, indexed by fn.
+    pub consumes: Vec<Vec<usize>>,
+    /// Slots of resources each fn produces, indexed by fn.
+    pub produces: Vec<Vec<usize>>,
+}
+
+impl ResIndex {
+    pub fn new(g: &Group, t: &Target) -> Self {
+        let mut uses = HashMap::new();
+        g.iter_fn()
+            .enumerate()
+            .for_each(|(i, f)| res_use(i, f, t, &mut uses));
+
+        let slot_num = t.res_slot_num();
+        let mut index = ResIndex {
+            producers: vec![Vec::new(); slot_num],
+            consumers: vec![Vec::new(); slot_num],
+            consumes: vec![Vec::new(); g.fn_num()],
+            produces: vec![Vec::new(); g.fn_num()],
+        };
+        for (tid, u) in uses.into_iter() {
+            let slot = t.res_slot_of(tid).unwrap();
+            for &c in &u.consumer {
+                index.consumes[c].push(slot);
+            }
+            for &p in &u.producer {
+                index.produces[p].push(slot);
+            }
+            index.producers[slot] = u.producer;
+            index.consumers[slot] = u.consumer;
+        }
+        for c in index.consumes.iter_mut().chain(index.produces.iter_mut()) {
+            c.sort_unstable();
+            c.dedup();
+        }
+        index
+    }
+}
+
 fn attr_analyze(g: &Group, r: &mut RTable) {
     for (i, f) in g.iter_fn().enumerate() {
         if let Some(attr) = f.get_attr(FUNC_ATTR_IMPACT) {
@@ -158,6 +312,11 @@ fn record_use(uses: &mut HashMap<TypeId, Use>, res: TypeId, fn_index: usize, in_
     }
 }
 
+/// Evidence of each adjacent pair in a minimized prog.
+const PROG_EVIDENCE: f32 = 0.3;
+/// Evidence of removal experiment, stronger than adjacency since it's tested.
+const REMOVAL_EVIDENCE: f32 = 0.6;
+
 /// Analyze call seq of prog, update RTable
 ///
 /// Analysis is based on the order of target in a prog.
@@ -177,7 +336,56 @@ pub fn prog_analyze(g: &Group, r: &mut RTable, p: &Prog) {
 
     for i in (0..id_index.len()).rev() {
         if i != 0 {
-            r[(id_index[i], id_index[i - 1])] = Relation::Some;
+            r.learn(id_index[i], id_index[i - 1], PROG_EVIDENCE);
+        }
+    }
+}
+
+/// Analyze result of removal experiment of minimization, update RTable
+///
+/// Removing call i from p lost new coverage of last call, so call i
+/// has impact on last call.
+pub fn removal_analyze(g: &Group, r: &mut RTable, p: &Prog, i: usize) {
+    assert!(i < p.len() - 1);
+
+    let last = g.index_by_id(p.calls[p.len() - 1].fid);
+    let cause = g.index_by_id(p.calls[i].fid);
+    if let (Some(last), Some(cause)) = (last, cause) {
+        if last != cause {
+            r.learn(last, cause, REMOVAL_EVIDENCE);
         }
+    } else {
+        panic!("prog out of group{}", g.id);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::analyze::{LearnedRelations, RTable, Relation};
+    use std::collections::HashMap;
+
+    #[test]
+    fn learned_round_trip() {
+        let mut r = RTable::new(4);
+        r[(0, 1)] = Relation::Some;
+        r.learn(0, 1, 0.5);
+        r.learn(1, 2, 0.5);
+        r.learn(1, 2, 0.5);
+        r.learn(3, 0, 0.01);
+
+        let dumped = vec![(7, r.dump_learned())]
+            .into_iter()
+            .collect::<HashMap<_, _>>();
+        let data = bincode::serialize(&dumped).unwrap();
+        let loaded: HashMap<usize, LearnedRelations> = bincode::deserialize(&data).unwrap();
+
+        let mut restored = RTable::new(4);
+        assert!(restored.restore_learned(&loaded[&7]));
+        // Static relations are not learned, weak ones are forgotten.
+        assert_eq!(restored.learned_len(), 1);
+        assert_eq!(restored.weight(1, 2), r.weight(1, 2));
+        assert_eq!(restored.weight(3, 0), 0.0);
+
+        assert!(!RTable::new(3).restore_learned(&loaded[&7]));
     }
 }
@@ -36,13 +36,56 @@ pub fn to_script(p: &Prog, t: &Target) -> Script {
 }
 
 pub fn to_prog(p: &Prog, t: &Target) -> String {
+    translate_prog(p, t, &[], |_| "return 0;".to_string())
+}
+
+/// Exit code of probe prog if its last call failed with ENOSYS.
+pub const PROBE_ENOSYS: i32 = 111;
+
+/// Translate prog to c for probing, main returns PROBE_ENOSYS if the last
+/// call returns -1 with errno ENOSYS. A call whose return value is not
+/// a number can't be told, it's taken as implemented.
+pub fn to_probe_prog(p: &Prog, t: &Target) -> String {
+    let ret_checkable = p
+        .calls
+        .last()
+        .and_then(|c| t.fn_of(c.fid).r_tid)
+        .map(|tid| is_scalar(tid, t))
+        .unwrap_or(false);
+    translate_prog(p, t, &["errno.h"], |ret| match ret {
+        Some(ret) if ret_checkable => format!(
+            "return ({} == -1 && errno == ENOSYS) ? {} : 0;",
+            ret, PROBE_ENOSYS
+        ),
+        _ => "return 0;".to_string(),
+    })
+}
+
+fn is_scalar(tid: TypeId, t: &Target) -> bool {
+    match t.type_of(tid) {
+        TypeInfo::Num(_) | TypeInfo::Flag { .. } | TypeInfo::Len { .. } => true,
+        TypeInfo::Alias { tid, .. } | TypeInfo::Res { tid } => is_scalar(*tid, t),
+        _ => false,
+    }
+}
+
+/// Translate prog to a c program, epilogue is made from name of variable
+/// holding return value of the last call.
+fn translate_prog<F: FnOnce(Option<&str>) -> String>(
+    p: &Prog,
+    t: &Target,
+    extra_includes: &[&str],
+    epilogue: F,
+) -> String {
     use crate::c::cths::CTHS;
 
     let mut includes =
         hashset! {  "stddef.h".to_string(),"stdint.h".to_string(),"stdlib.h".to_string(),};
+    includes.extend(extra_includes.iter().map(|h| (*h).to_string()));
     let mut c_stmts = String::new();
 
-    for (call_index, stmts) in iter_trans(p, t).enumerate() {
+    let mut trans = iter_trans(p, t);
+    for (call_index, stmts) in (&mut trans).enumerate() {
         let fn_info = t.fn_of(p.calls[call_index].fid);
         let call_name = fn_info.call_name.clone();
         if let Some(inc_attr) = fn_info.get_attr("inc") {
@@ -60,6 +103,11 @@ pub fn to_prog(p: &Prog, t: &Target) -> String {
 
         writeln!(c_stmts, "{}", stmts.to_string()).unwrap();
     }
+    let ret = p
+        .len()
+        .checked_sub(1)
+        .and_then(|i| trans.s.res.get(&(i, ArgPos::Ret)));
+    let epilogue = epilogue(ret.map(|r| r.as_str()));
 
     let mut incs = String::new();
     writeln!(incs, "#define _GNU_SOURCE").unwrap();
@@ -71,9 +119,9 @@ pub fn to_prog(p: &Prog, t: &Target) -> String {
 
 int main(int argc, char **argv){{
 {}
-return 0;
+{}
 }}"#,
-        incs, c_stmts
+        incs, c_stmts, epilogue
     )
 }
 
@@ -214,6 +262,9 @@ fn translate_str(str_type: &StrType, v: &Value) -> Exp {
 
 /// declare varible of tid type with val value, record in state and return name of var
 fn decl_var(tid: TypeId, val: &Value, t: &Target, s: &mut State) -> String {
+    if let Value::Scratch(len) = val {
+        return decl_scratch(tid, *len, t, s);
+    }
     match t.type_of(tid) {
         TypeInfo::Num(info) => decl_num(info, val, s),
         TypeInfo::Flag { .. } => decl_num(&NumInfo::U32(NumLimit::None), val, s),
@@ -234,6 +285,30 @@ fn decl_var(tid: TypeId, val: &Value, t: &Target, s: &mut State) -> String {
     }
 }
 
+/// Declare zeroed buffer for out pointer, slice or str of len elements.
+fn decl_scratch(tid: TypeId, len: usize, t: &Target, s: &mut State) -> String {
+    let name = match t.type_of(tid) {
+        TypeInfo::Alias { tid, .. } | TypeInfo::Res { tid } => {
+            return decl_scratch(*tid, len, t, s)
+        }
+        _ => s.var_names.next_p("b"),
+    };
+    let (ts, decl) = match t.type_of(tid) {
+        TypeInfo::Slice { tid, .. } => map_array(*tid, &name, Some(len.max(1)), t),
+        // buffer is written by callee, so even file name needs an array
+        TypeInfo::Str { .. } => (
+            TypeSpecifier::Char,
+            Declarator::Array {
+                decl: Box::new(Declarator::Ident(name.clone())),
+                len: len.max(1),
+            },
+        ),
+        _ => declarator_map(tid, &name, t),
+    };
+    s.add_decl(ts, decl, Some(Exp::Zeroed));
+    name
+}
+
 fn decl_num(num_info: &NumInfo, val: &Value, s: &mut State) -> String {
     let name = s.var_names.next_p("n");
     let (ts, decl) = map_num(num_info, &name);
@@ -257,14 +332,18 @@ fn decl_str(str_type: &StrType, val: &Value, s: &mut State) -> String {
 
 fn decl_slice(under_tid: TypeId, val: &Value, t: &Target, s: &mut State) -> String {
     let name = s.var_names.next_p("a");
-    let len = if let Value::Group(v) = val {
-        v.len()
-    } else {
-        panic!("Value type not match")
+    let len = match val {
+        Value::Group(v) => v.len(),
+        Value::Bytes(b) => b.len(),
+        _ => panic!("Value type not match"),
     };
 
     let (ts, decl) = map_array(under_tid, &name, Some(len), t);
-    let exp = translate_slice(under_tid, val, t, s);
+    let exp = if let Value::Bytes(b) = val {
+        Exp::BytesLiteral(b.to_vec())
+    } else {
+        translate_slice(under_tid, val, t, s)
+    };
     s.add_decl(ts, decl, Some(exp));
     name
 }
@@ -463,7 +542,11 @@ pub enum Exp {
     CharLiteral(char),
     NumLiteral(String),
     StrLiteral(String),
+    /// Initializer of byte array, every byte is escaped.
+    BytesLiteral(Vec<u8>),
     ListExp(Vec<Exp>),
+    /// Zero initializer of any type.
+    Zeroed,
     Var(String),
     Ref(String),
     Call(CallExp),
@@ -476,6 +559,16 @@ impl Display for Exp {
             Exp::CharLiteral(ch) => write!(f, "'{}'", ch),
             Exp::NumLiteral(n) => write!(f, "{}", n),
             Exp::StrLiteral(s) => write!(f, "\"{}\"", s),
+            Exp::BytesLiteral(b) if b.is_empty() => write!(f, "{{}}"),
+            Exp::BytesLiteral(b) => {
+                let mut buf = String::with_capacity(b.len() * 4 + 2);
+                buf.push('"');
+                for b in b.iter() {
+                    write!(buf, "\\x{:02x}", b).unwrap();
+                }
+                buf.push('"');
+                write!(f, "{}", buf)
+            }
             Exp::ListExp(exps) => {
                 let mut buf = String::new();
                 buf.push('{');
@@ -489,6 +582,7 @@ impl Display for Exp {
                 buf.push('}');
                 write!(f, "{}", buf)
             }
+            Exp::Zeroed => write!(f, "{{0}}"),
             Exp::Var(v) => write!(f, "{}", v),
             Exp::Ref(v) => write!(f, "&{}", v),
             Exp::Call(c) => write!(f, "{}", c),
@@ -0,0 +1,351 @@
+//! Encoding
+//!
+//! Compact encoding of prog for sending to executor. Ids and lengths are
+//! varints, signed nums are zigzag encoded, and type ids of args are not
+//! encoded, since they can be recovered from prototype of each call.
+//!
+//! ```text
+//! prog  := gid call_num call*
+//! call  := fid arg_num value* has_ret [value]
+//! value := tag payload
+//! ```
+use std::error::Error;
+use std::fmt::{self, Display, Formatter};
+
+use fots::types::{FnId, TypeId};
+
+use crate::prog::{Arg, ArgIndex, ArgPos, Call, Prog};
+use crate::target::Target;
+use crate::value::{NumValue, Value};
+
+const TAG_NONE: u8 = 0;
+const TAG_UNSIGNED: u8 = 1;
+const TAG_SIGNED: u8 = 2;
+const TAG_STR: u8 = 3;
+const TAG_BYTES: u8 = 4;
+const TAG_GROUP: u8 = 5;
+const TAG_OPT: u8 = 6;
+const TAG_REF: u8 = 7;
+const TAG_SCRATCH: u8 = 8;
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum DecodeError {
+    Eof,
+    UnknownFn(FnId),
+    ArgNum(FnId, usize),
+    Tag(u8),
+    Utf8,
+    /// Ref to a call not before the referring one, or to a missing arg of it.
+    Ref(ArgIndex),
+}
+
+impl Display for DecodeError {
+    fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+        match self {
+            DecodeError::Eof => write!(f, "unexpected end of data"),
+            DecodeError::UnknownFn(fid) => write!(f, "unknown fn {}", fid),
+            DecodeError::ArgNum(fid, n) => write!(f, "fn {} with {} args", fid, n),
+            DecodeError::Tag(tag) => write!(f, "unknown value tag {}", tag),
+            DecodeError::Utf8 => write!(f, "invalid utf-8 string"),
+            DecodeError::Ref((cid, pos)) => write!(f, "invalid ref to {:?} of call {}", pos, cid),
+        }
+    }
+}
+
+impl Error for DecodeError {}
+
+/// Append encoded p to buf.
+pub fn encode_prog(p: &Prog, t: &Target, buf: &mut Vec<u8>) {
+    put_varint(buf, p.gid as u64);
+    put_varint(buf, p.calls.len() as u64);
+    for c in p.calls.iter() {
+        debug_assert!(c
+            .args
+            .iter()
+            .zip(t.fn_of(c.fid).iter_param())
+            .all(|(a, p)| a.tid == p.tid));
+
+        put_varint(buf, c.fid as u64);
+        put_varint(buf, c.args.len() as u64);
+        for a in c.args.iter() {
+            encode_value(&a.val, buf);
+        }
+        if let Some(r) = c.ret.as_ref() {
+            buf.push(1);
+            encode_value(&r.val, buf);
+        } else {
+            buf.push(0);
+        }
+    }
+}
+
+fn encode_value(val: &Value, buf: &mut Vec<u8>) {
+    match val {
+        Value::None => buf.push(TAG_NONE),
+        Value::Num(NumValue::Unsigned(n)) => {
+            buf.push(TAG_UNSIGNED);
+            put_varint(buf, *n);
+        }
+        Value::Num(NumValue::Signed(n)) => {
+            buf.push(TAG_SIGNED);
+            put_varint(buf, ((n << 1) ^ (n >> 63)) as u64);
+        }
+        Value::Str(s) => {
+            buf.push(TAG_STR);
+            put_varint(buf, s.len() as u64);
+            buf.extend_from_slice(s.as_bytes());
+        }
+        Value::Bytes(b) => {
+            buf.push(TAG_BYTES);
+            put_varint(buf, b.len() as u64);
+            buf.extend_from_slice(b);
+        }
+        Value::Group(vals) => {
+            buf.push(TAG_GROUP);
+            put_varint(buf, vals.len() as u64);
+            for v in vals.iter() {
+                encode_value(v, buf);
+            }
+        }
+        Value::Opt { choice, val } => {
+            buf.push(TAG_OPT);
+            put_varint(buf, *choice as u64);
+            encode_value(val, buf);
+        }
+        Value::Ref((cid, pos)) => {
+            buf.push(TAG_REF);
+            put_varint(buf, *cid as u64);
+            match pos {
+                ArgPos::Ret => put_varint(buf, 0),
+                ArgPos::Arg(i) => put_varint(buf, *i as u64 + 1),
+            }
+        }
+        Value::Scratch(len) => {
+            buf.push(TAG_SCRATCH);
+            put_varint(buf, *len as u64);
+        }
+    }
+}
+
+/// Decode prog encoded by encode_prog.
+pub fn decode_prog(buf: &[u8], t: &Target) -> Result<Prog, DecodeError> {
+    let mut r = Reader { buf, pos: 0 };
+    let mut p = Prog::new(r.varint()? as usize);
+    let call_num = r.varint()? as usize;
+    p.calls.reserve(call_num.min(buf.len()));
+    for _ in 0..call_num {
+        let fid = r.varint()? as FnId;
+        if !t.fns.contains_key(&fid) {
+            return Err(DecodeError::UnknownFn(fid));
+        }
+        let f = t.fn_of(fid);
+        let tids = if f.has_params() {
+            f.iter_param().map(|p| p.tid).collect::<Vec<TypeId>>()
+        } else {
+            Vec::new()
+        };
+        let arg_num = r.varint()? as usize;
+        if arg_num != tids.len() {
+            return Err(DecodeError::ArgNum(fid, arg_num));
+        }
+
+        let mut c = Call::new(fid);
+        c.args.reserve(arg_num);
+        for tid in tids {
+            let val = r.value(&p.calls)?;
+            c.args.push(Arg { tid, val });
+        }
+        if r.byte()? != 0 {
+            let val = r.value(&p.calls)?;
+            let tid = f.r_tid.ok_or(DecodeError::ArgNum(fid, arg_num))?;
+            c.ret = Some(Arg { tid, val });
+        }
+        p.calls.push(c);
+    }
+    Ok(p)
+}
+
+struct Reader<'a> {
+    buf: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Reader<'a> {
+    fn byte(&mut self) -> Result<u8, DecodeError> {
+        let b = *self.buf.get(self.pos).ok_or(DecodeError::Eof)?;
+        self.pos += 1;
+        Ok(b)
+    }
+
+    fn bytes(&mut self, len: usize) -> Result<&'a [u8], DecodeError> {
+        if self.buf.len() - self.pos < len {
+            return Err(DecodeError::Eof);
+        }
+        let b = &self.buf[self.pos..self.pos + len];
+        self.pos += len;
+        Ok(b)
+    }
+
+    fn varint(&mut self) -> Result<u64, DecodeError> {
+        let mut n = 0;
+        let mut shift = 0;
+        loop {
+            let b = self.byte()?;
+            if shift < 64 {
+                n |= u64::from(b & 0x7f) << shift;
+            }
+            if b & 0x80 == 0 {
+                return Ok(n);
+            }
+            shift += 7;
+        }
+    }
+
+    /// Decode a value of a call following calls, the only ones it may refer to.
+    fn value(&mut self, calls: &[Call]) -> Result<Value, DecodeError> {
+        let val = match self.byte()? {
+            TAG_NONE => Value::None,
+            TAG_UNSIGNED => Value::Num(NumValue::Unsigned(self.varint()?)),
+            TAG_SIGNED => {
+                let n = self.varint()?;
+                Value::Num(NumValue::Signed((n >> 1) as i64 ^ -((n & 1) as i64)))
+            }
+            TAG_STR => {
+                let len = self.varint()? as usize;
+                let s = std::str::from_utf8(self.bytes(len)?).map_err(|_| DecodeError::Utf8)?;
+                Value::Str(s.to_string())
+            }
+            TAG_BYTES => {
+                let len = self.varint()? as usize;
+                Value::Bytes(self.bytes(len)?.into())
+            }
+            TAG_GROUP => {
+                let len = self.varint()? as usize;
+                // every value takes one byte at least
+                let mut vals = Vec::with_capacity(len.min(self.buf.len() - self.pos));
+                for _ in 0..len {
+                    vals.push(self.value(calls)?);
+                }
+                Value::Group(vals)
+            }
+            TAG_OPT => {
+                let choice = self.varint()? as usize;
+                Value::Opt {
+                    choice,
+                    val: Box::new(self.value(calls)?),
+                }
+            }
+            TAG_REF => {
+                let cid = self.varint()? as usize;
+                let pos = match self.varint()? {
+                    0 => ArgPos::Ret,
+                    i => ArgPos::Arg(i as usize - 1),
+                };
+                let valid = calls.get(cid).map_or(false, |c| match pos {
+                    ArgPos::Ret => c.ret.is_some(),
+                    ArgPos::Arg(i) => i < c.args.len(),
+                });
+                if !valid {
+                    return Err(DecodeError::Ref((cid, pos)));
+                }
+                Value::Ref((cid, pos))
+            }
+            TAG_SCRATCH => Value::Scratch(self.varint()? as usize),
+            tag => return Err(DecodeError::Tag(tag)),
+        };
+        Ok(val)
+    }
+}
+
+#[inline]
+fn put_varint(buf: &mut Vec<u8>, mut n: u64) {
+    while n >= 0x80 {
+        buf.push(n as u8 | 0x80);
+        n >>= 7;
+    }
+    buf.push(n as u8);
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::encode::{decode_prog, encode_prog, put_varint, DecodeError, Reader};
+    use crate::prog::{Arg, ArgPos, Call, Prog};
+    use crate::target::Target;
+    use crate::value::{NumValue, Value};
+
+    #[test]
+    fn varint() {
+        for &n in &[0, 0x7f, 0x80, u64::from(u32::max_value()), u64::max_value()] {
+            let mut buf = Vec::new();
+            put_varint(&mut buf, n);
+            assert!(buf.len() <= 10);
+            let mut r = Reader { buf: &buf, pos: 0 };
+            assert_eq!(r.varint(), Ok(n));
+            assert_eq!(r.pos, buf.len());
+        }
+    }
+
+    #[test]
+    fn round_trip() {
+        let items = fots::parse_items("fn foo(a i64, b u64, c *[i8], d i32) i32").unwrap();
+        let t = Target::from(items);
+        let f = t.iter_group().flat_map(|g| g.iter_fn()).next().unwrap();
+        let vals = vec![
+            Value::Num(NumValue::Signed(i64::min_value())),
+            Value::Num(NumValue::Unsigned(u64::max_value())),
+            Value::Group(vec![
+                Value::Num(NumValue::Signed(-1)),
+                Value::Group(vec![
+                    Value::Str("foo".into()),
+                    Value::Bytes(vec![0, 0xff].into()),
+                    Value::None,
+                ]),
+                Value::Opt {
+                    choice: 3,
+                    val: Box::new(Value::Group(vec![Value::Scratch(4096)])),
+                },
+            ]),
+            Value::Num(NumValue::Signed(0)),
+        ];
+        let mut p = Prog::new(f.gid);
+        for _ in 0..2 {
+            let c = p.add_call(Call::new(f.id));
+            c.args = f
+                .iter_param()
+                .zip(vals.iter())
+                .map(|(param, val)| Arg {
+                    tid: param.tid,
+                    val: val.clone(),
+                })
+                .collect();
+            c.ret = f.r_tid.map(|tid| Arg {
+                tid,
+                val: Value::None,
+            });
+        }
+        p.calls[1].args[3].val = Value::Ref((0, ArgPos::Ret));
+
+        let mut buf = Vec::new();
+        encode_prog(&p, &t, &mut buf);
+        assert_eq!(decode_prog(&buf, &t), Ok(p.clone()));
+        for len in 0..buf.len() {
+            assert!(decode_prog(&buf[..len], &t).is_err());
+        }
+
+        // refs to the call itself, to a later call or to a missing arg
+        for (cid, refd) in [
+            (0, (0, ArgPos::Ret)),
+            (0, (1, ArgPos::Ret)),
+            (1, (0, ArgPos::Arg(4))),
+        ]
+        .iter()
+        {
+            let mut p = p.clone();
+            p.calls[1].args[3].val = Value::None;
+            p.calls[*cid].args[2].val = Value::Group(vec![Value::Ref(refd.clone())]);
+            let mut buf = Vec::new();
+            encode_prog(&p, &t, &mut buf);
+            assert_eq!(decode_prog(&buf, &t), Err(DecodeError::Ref(refd.clone())));
+        }
+    }
+}
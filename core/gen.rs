@@ -14,19 +14,28 @@
 use std::collections::HashMap;
 use std::path::PathBuf;
 
-use ndarray::Axis;
 use rand::distributions::Alphanumeric;
 use rand::prelude::*;
 use rand::{random, thread_rng, Rng};
 
 use fots::types::{
-    Field, Flag, FnInfo, GroupId, NumInfo, NumLimit, PtrDir, StrType, TypeId, TypeInfo,
+    Field, Flag, FnInfo, Group, GroupId, NumInfo, NumLimit, PtrDir, RuleExp, RuleInfo, StrType,
+    TplArg, TplCall, TypeId, TypeInfo,
 };
 
-use crate::analyze::{RTable, Relation};
+use crate::analyze::{RTable, ResIndex};
 use crate::prog::{Arg, ArgIndex, ArgPos, Call, Prog};
 use crate::target::Target;
-use crate::value::{NumValue, Value};
+use crate::value::{is_byte, NumValue, Value};
+
+/// Probability of expanding a call with one of its rules.
+const RULE_PROB: f64 = 0.5;
+/// Max times repeated exp of rule is made.
+const RULE_MAX_REPEAT: usize = 3;
+/// Max number of strings of each string type in pool.
+const STR_POOL_SIZE: usize = 256;
+/// Probability of taking string from pool instead of making a new one.
+const STR_POOL_PROB: f64 = 0.5;
 
 #[derive(Clone)]
 pub struct Config {
@@ -36,6 +45,8 @@ pub struct Config {
     pub str_max_len: usize,
     pub path_max_depth: usize,
     pub sp_delta: f64,
+    /// Extra selection weight of each interface of group, indexed like RTable.
+    pub call_weights: Option<Vec<f64>>,
 }
 
 impl Default for Config {
@@ -47,46 +58,313 @@ impl Default for Config {
             str_max_len: 32,
             path_max_depth: 4,
             sp_delta: 0.4,
+            call_weights: None,
+        }
+    }
+}
+
+/// Strings of successfully executed progs, shared by progs generated for the same vm.
+///
+/// Files created by a prog are only reached by later progs when their names are
+/// reused, so pool keeps a bounded number of strings of each string type.
+#[derive(Debug, Default)]
+pub struct StrPool {
+    strs: HashMap<StrType, Vec<String>>,
+    hits: usize,
+    lookups: usize,
+}
+
+impl StrPool {
+    /// Record strings of p, random old ones are replaced if pool is full.
+    pub fn extend_with(&mut self, p: &Prog, t: &Target) {
+        for c in p.calls.iter() {
+            for arg in c.args.iter() {
+                collect_strs(arg.tid, &arg.val, t, self);
+            }
+        }
+    }
+
+    fn insert(&mut self, str_type: &StrType, val: &str) {
+        let strs = self.strs.entry(str_type.clone()).or_default();
+        if strs.iter().any(|s| s == val) {
+            return;
+        }
+        if strs.len() < STR_POOL_SIZE {
+            strs.push(val.to_string());
+        } else {
+            let i = thread_rng().gen_range(0, strs.len());
+            strs[i] = val.to_string();
+        }
+    }
+
+    fn choose(&mut self, str_type: &StrType) -> Option<String> {
+        self.lookups += 1;
+        let s = self
+            .strs
+            .get(str_type)
+            .and_then(|strs| strs.choose(&mut thread_rng()))
+            .cloned();
+        if s.is_some() {
+            self.hits += 1;
+        }
+        s
+    }
+
+    /// Number of hits and lookups since last call.
+    pub fn take_counts(&mut self) -> (usize, usize) {
+        let counts = (self.hits, self.lookups);
+        self.hits = 0;
+        self.lookups = 0;
+        counts
+    }
+}
+
+fn collect_strs(tid: TypeId, val: &Value, t: &Target, pool: &mut StrPool) {
+    match (t.type_of(tid), val) {
+        (TypeInfo::Str { str_type, .. }, Value::Str(s)) => pool.insert(str_type, s),
+        (TypeInfo::Ptr { tid, .. }, _)
+        | (TypeInfo::Alias { tid, .. }, _)
+        | (TypeInfo::Res { tid }, _) => collect_strs(*tid, val, t, pool),
+        (TypeInfo::Slice { tid, .. }, Value::Group(vals)) => {
+            for v in vals.iter() {
+                collect_strs(*tid, v, t, pool);
+            }
+        }
+        (TypeInfo::Struct { fields, .. }, Value::Group(vals)) => {
+            for (f, v) in fields.iter().zip(vals.iter()) {
+                collect_strs(f.tid, v, t, pool);
+            }
         }
+        (TypeInfo::Union { fields, .. }, Value::Opt { choice, val }) => {
+            collect_strs(fields[*choice].tid, val, t, pool)
+        }
+        _ => (),
     }
 }
 
 pub fn gen<S: std::hash::BuildHasher>(
     t: &Target,
     rs: &HashMap<GroupId, RTable, S>,
+    strs: &mut StrPool,
     conf: &Config,
 ) -> Prog {
-    assert!(!rs.is_empty());
     assert_eq!(t.groups.len(), rs.len());
 
+    let gid = choose_group(rs);
+    gen_prog(gid, &rs[&gid], t, strs, conf)
+}
+
+/// Choose group to generate prog for, skip groups whose interfaces are all disabled.
+pub fn choose_group<S: std::hash::BuildHasher>(rs: &HashMap<GroupId, RTable, S>) -> GroupId {
+    assert!(!rs.is_empty());
+
     let mut rng = thread_rng();
-    // choose group
-    let gid = rs.keys().choose(&mut rng).unwrap();
-    gen_prog(*gid, &rs[gid], t, conf)
+    let gid = rs
+        .iter()
+        .filter(|(_, r)| r.enabled_num() != 0)
+        .map(|(gid, _)| gid)
+        .choose(&mut rng)
+        .unwrap_or_else(|| rs.keys().choose(&mut rng).unwrap());
+    *gid
 }
 
-pub fn gen_prog(gid: GroupId, r: &RTable, t: &Target, conf: &Config) -> Prog {
+pub fn gen_prog(gid: GroupId, r: &RTable, t: &Target, strs: &mut StrPool, conf: &Config) -> Prog {
     // choose sequence
     let seq = choose_seq(r, conf);
     assert!(!seq.is_empty());
+    let seq = complete_res(&seq, &t.res_index[&gid], r, conf);
+    let steps = apply_rules(&seq, gid, r, t, conf);
+
+    gen_steps(&steps, gid, t, Some(strs), conf)
+}
+
+/// Insert a producer before each call that consumes resource not produced by
+/// any previous call, as long as prog_max_len allows.
+fn complete_res(seq: &[usize], index: &ResIndex, r: &RTable, conf: &Config) -> Vec<usize> {
+    let mut rng = thread_rng();
+    let mut produced: Vec<usize> = Vec::new();
+    let mut result = Vec::with_capacity(seq.len());
+
+    for (i, &f) in seq.iter().enumerate() {
+        for slot in &index.consumes[f] {
+            // keep room for rest of seq
+            if produced.contains(slot) || result.len() + seq.len() - i >= conf.prog_max_len {
+                continue;
+            }
+            let producer = index.producers[*slot]
+                .iter()
+                .filter(|&&p| p != f && r.is_enabled(p))
+                .choose(&mut rng);
+            if let Some(&p) = producer {
+                result.push(p);
+                produced.extend(&index.produces[p]);
+            }
+        }
+        result.push(f);
+        produced.extend(&index.produces[f]);
+    }
+    result
+}
+
+/// Call of seq to make, with constraints of its args from rule.
+struct Step<'a> {
+    index: usize,
+    cons: Vec<Option<Constraint<'a>>>,
+}
+
+/// Constraint of arg from rule.
+enum Constraint<'a> {
+    /// Resource returned by call of prog.
+    Ref(usize),
+    Str(&'a str),
+    Num(i64),
+}
+
+/// Expand calls of seq with rules they appear in, as long as prog_max_len allows.
+/// Bindings of rule are made first, then its exp. Each rule is applied at most once.
+fn apply_rules<'a>(
+    seq: &[usize],
+    gid: GroupId,
+    r: &RTable,
+    t: &'a Target,
+    conf: &Config,
+) -> Vec<Step<'a>> {
+    let g = &t.groups[&gid];
+    let mut rng = thread_rng();
+    let mut applied = Vec::new();
+    let mut steps = Vec::with_capacity(seq.len());
+
+    for (i, &f) in seq.iter().enumerate() {
+        let rule = t
+            .rules_of(g.fns[f].id)
+            .iter()
+            .filter(|ri| !applied.contains(*ri))
+            .choose(&mut rng);
+        if let Some(&ri) = rule {
+            if rng.gen::<f64>() < RULE_PROB {
+                let rule_steps = expand_rule(&t.rules[ri], g, steps.len(), &mut rng);
+                // keep room for rest of seq
+                if steps.len() + rule_steps.len() + seq.len() - i <= conf.prog_max_len
+                    && rule_steps.iter().all(|s| r.is_enabled(s.index))
+                {
+                    applied.push(ri);
+                    let made = rule_steps.iter().any(|s| s.index == f);
+                    steps.extend(rule_steps);
+                    if made {
+                        continue;
+                    }
+                }
+            }
+        }
+        steps.push(Step {
+            index: f,
+            cons: Vec::new(),
+        });
+    }
+    steps
+}
+
+fn expand_rule<'a, R: Rng>(
+    rule: &'a RuleInfo,
+    g: &Group,
+    base: usize,
+    rng: &mut R,
+) -> Vec<Step<'a>> {
+    let mut steps = Vec::new();
+    let mut binds = HashMap::new();
+    for (ident, c) in rule.binds.iter() {
+        steps.push(tpl_step(c, g, &binds));
+        binds.insert(&ident[..], base + steps.len() - 1);
+    }
+    expand_exp(&rule.exp, g, &binds, rng, &mut steps);
+    steps
+}
+
+fn expand_exp<'a, R: Rng>(
+    exp: &'a RuleExp,
+    g: &Group,
+    binds: &HashMap<&str, usize>,
+    rng: &mut R,
+    steps: &mut Vec<Step<'a>>,
+) {
+    match exp {
+        RuleExp::Call(c) => steps.push(tpl_step(c, g, binds)),
+        RuleExp::Seq(exps) => {
+            for e in exps.iter() {
+                expand_exp(e, g, binds, rng, steps);
+            }
+        }
+        RuleExp::Choice(exps) => {
+            let e = exps.choose(rng).unwrap();
+            expand_exp(e, g, binds, rng, steps);
+        }
+        RuleExp::Repeat(e) => {
+            for _ in 0..rng.gen_range(0, RULE_MAX_REPEAT + 1) {
+                expand_exp(e, g, binds, rng, steps);
+            }
+        }
+    }
+}
 
-    gen_seq(&seq, gid, t, conf)
+fn tpl_step<'a>(c: &'a TplCall, g: &Group, binds: &HashMap<&str, usize>) -> Step<'a> {
+    let index = g.fns.iter().position(|f| f.id == c.fid).unwrap();
+    let cons = c
+        .args
+        .iter()
+        .map(|a| match a {
+            TplArg::Any => None,
+            TplArg::Ref(ident) => binds.get(&ident[..]).map(|&cid| Constraint::Ref(cid)),
+            TplArg::Str(val) => Some(Constraint::Str(val)),
+            TplArg::Num(n) => Some(Constraint::Num(*n)),
+        })
+        .collect();
+    Step { index, cons }
 }
 
 pub fn gen_seq(seq: &[usize], gid: GroupId, t: &Target, conf: &Config) -> Prog {
+    gen_steps(&plain_steps(seq), gid, t, None, conf)
+}
+
+/// Same as gen_seq, strings may be taken from pool.
+pub fn gen_seq_with(
+    seq: &[usize],
+    gid: GroupId,
+    t: &Target,
+    strs: &mut StrPool,
+    conf: &Config,
+) -> Prog {
+    gen_steps(&plain_steps(seq), gid, t, Some(strs), conf)
+}
+
+fn plain_steps(seq: &[usize]) -> Vec<Step<'static>> {
+    seq.iter()
+        .map(|&index| Step {
+            index,
+            cons: Vec::new(),
+        })
+        .collect()
+}
+
+fn gen_steps(
+    steps: &[Step],
+    gid: GroupId,
+    t: &Target,
+    pool: Option<&mut StrPool>,
+    conf: &Config,
+) -> Prog {
     let g = &t.groups[&gid];
     assert!(!g.fns.is_empty());
 
     // gen value
-    let mut s = State::new(Prog::new(g.id), conf);
-    for &i in seq.iter() {
-        gen_call(t, &g.fns[i], &mut s);
+    let mut s = State::new(Prog::new(g.id), pool, conf);
+    for step in steps.iter() {
+        gen_call(t, &g.fns[step.index], &step.cons, &mut s);
     }
     adjust_size_param(&mut s.prog, t);
     s.prog
 }
 
-fn adjust_size_param(p: &mut Prog, t: &Target) {
+pub(crate) fn adjust_size_param(p: &mut Prog, t: &Target) {
     for c in &mut p.calls.iter_mut() {
         let f = t.fn_of(c.fid);
         if f.has_params() {
@@ -107,11 +385,10 @@ fn adjust_size_param(p: &mut Prog, t: &Target) {
 
 fn adjust_size(tid: TypeId, v: &mut Value, t: &Target) {
     match t.type_of(tid) {
-        TypeInfo::Ptr { tid, .. } => {
-            if v != &Value::None {
-                adjust_size(*tid, v, t);
-            }
-        }
+        TypeInfo::Ptr { tid, .. } => match v {
+            Value::None | Value::Scratch(_) => (),
+            _ => adjust_size(*tid, v, t),
+        },
         TypeInfo::Slice { tid, .. } => {
             if let Value::Group(vals) = v {
                 for v in vals.iter_mut() {
@@ -180,56 +457,71 @@ fn asign_len_val(index: usize, path: &str, fields: &[Field], vals: &mut [Value],
 }
 
 struct State<'a> {
-    res: HashMap<TypeId, Vec<ArgIndex>>,
-    strs: HashMap<StrType, Vec<String>>,
+    /// Resources produced so far, slot of resource type and where it is.
+    res: Vec<(usize, ArgIndex)>,
+    /// Strings generated so far.
+    strs: Vec<(StrType, String)>,
+    /// Strings of previous progs.
+    pool: Option<&'a mut StrPool>,
     prog: Prog,
     conf: &'a Config,
 }
 
 impl<'a> State<'a> {
-    pub fn new(prog: Prog, conf: &'a Config) -> Self {
+    pub fn new(prog: Prog, pool: Option<&'a mut StrPool>, conf: &'a Config) -> Self {
         Self {
-            res: HashMap::new(),
-            strs: hashmap! {StrType::FileName => Vec::new()},
+            res: Vec::new(),
+            strs: Vec::new(),
+            pool,
             prog,
             conf,
         }
     }
 
-    pub fn record_res(&mut self, tid: TypeId, is_ret: bool) {
+    pub fn record_res(&mut self, slot: usize, is_ret: bool) {
         let cid = self.prog.len() - 1;
 
-        let idx = self.res.entry(tid).or_insert_with(Default::default);
         if is_ret {
-            idx.push((cid, ArgPos::Ret))
+            self.res.push((slot, (cid, ArgPos::Ret)))
         } else {
             let arg_pos = self.prog.calls[cid].args.len() - 1;
-            idx.push((cid, ArgPos::Arg(arg_pos)))
+            self.res.push((slot, (cid, ArgPos::Arg(arg_pos))))
         }
     }
 
     pub fn record_str(&mut self, t: StrType, val: &str) {
-        let vals = self.strs.entry(t).or_insert_with(Default::default);
-        vals.push(val.into())
+        self.strs.push((t, val.into()))
     }
 
-    pub fn try_reuse_res(&self, tid: TypeId) -> Option<Value> {
-        let mut rng = thread_rng();
-        if let Some(res) = self.res.get(&tid) {
-            if !res.is_empty() {
-                let r = res.choose(&mut rng).unwrap();
-                return Some(Value::Ref(r.clone()));
-            }
+    pub fn try_reuse_res(&self, slot: usize) -> Option<Value> {
+        let n = self.res.iter().filter(|(s, _)| *s == slot).count();
+        if n != 0 {
+            let i = thread_rng().gen_range(0, n);
+            let r = self.res.iter().filter(|(s, _)| *s == slot).nth(i).unwrap();
+            return Some(Value::Ref(r.1.clone()));
         }
         None
     }
 
-    pub fn try_reuse_str(&self, str_type: StrType) -> Option<Value> {
+    pub fn try_reuse_str(&mut self, str_type: &StrType) -> Option<Value> {
         let mut rng = thread_rng();
-        if let Some(strs) = self.strs.get(&str_type) {
-            if !strs.is_empty() && rng.gen() {
-                let s = strs.choose(&mut rng).unwrap();
-                return Some(Value::Str(s.clone()));
+        let n = self.strs.iter().filter(|(t, _)| t == str_type).count();
+        if n != 0 && rng.gen() {
+            let i = rng.gen_range(0, n);
+            let s = self
+                .strs
+                .iter()
+                .filter(|(t, _)| t == str_type)
+                .nth(i)
+                .unwrap();
+            return Some(Value::Str(s.1.clone()));
+        }
+        if let Some(pool) = self.pool.as_mut() {
+            if rng.gen::<f64>() < STR_POOL_PROB {
+                if let Some(s) = pool.choose(str_type) {
+                    self.strs.push((str_type.clone(), s.clone()));
+                    return Some(Value::Str(s));
+                }
             }
         }
         None
@@ -259,22 +551,58 @@ impl<'a> State<'a> {
     }
 }
 
-fn gen_call(t: &Target, f: &FnInfo, s: &mut State) {
+fn gen_call(t: &Target, f: &FnInfo, cons: &[Option<Constraint>], s: &mut State) {
     s.add_call(Call::new(f.id));
 
     if f.has_params() {
-        for p in f.iter_param() {
+        for (i, p) in f.iter_param().enumerate() {
             s.add_arg(Arg::new(p.tid));
-            let val = gen_value(p.tid, t, s);
+            let val = match cons.get(i) {
+                Some(Some(c)) => constrained_value(p.tid, c, t, s),
+                _ => None,
+            };
+            let val = match val {
+                Some(val) => val,
+                None => gen_value(p.tid, t, s),
+            };
             s.update_val(val);
         }
     }
 
     if let Some(tid) = f.r_tid {
-        if t.is_res(tid) {
+        if let Some(slot) = t.res_slot_of(tid) {
             s.add_ret(Arg::new(tid));
-            s.record_res(tid, true);
+            s.record_res(slot, true);
+        }
+    }
+}
+
+/// Value of arg fixed by rule, None if constraint doesn't fit type of arg.
+fn constrained_value(tid: TypeId, c: &Constraint, t: &Target, s: &State) -> Option<Value> {
+    match (t.type_of(tid), c) {
+        (_, Constraint::Ref(cid)) if t.res_slot_of(tid).is_some() => s.prog.calls[*cid]
+            .ret
+            .as_ref()
+            .map(|_| Value::Ref((*cid, ArgPos::Ret))),
+        (
+            TypeInfo::Ptr {
+                dir: PtrDir::In,
+                tid,
+                ..
+            },
+            _,
+        )
+        | (TypeInfo::Alias { tid, .. }, _)
+        | (TypeInfo::Res { tid }, _) => constrained_value(*tid, c, t, s),
+        (TypeInfo::Num(_), Constraint::Num(n)) | (TypeInfo::Flag { .. }, Constraint::Num(n)) => {
+            if *n < 0 {
+                Some(Value::Num(NumValue::Signed(*n)))
+            } else {
+                Some(Value::Num(NumValue::Unsigned(*n as u64)))
+            }
         }
+        (TypeInfo::Str { .. }, Constraint::Str(val)) => Some(Value::Str(val.to_string())),
+        _ => None,
     }
 }
 
@@ -300,7 +628,7 @@ fn gen_value(tid: TypeId, t: &Target, s: &mut State) -> Value {
 }
 
 fn gen_alias(tid: TypeId, under_id: TypeId, t: &Target, s: &mut State) -> Value {
-    if t.is_res(tid) {
+    if t.res_slot_of(tid).is_some() {
         gen_res(tid, under_id, t, s)
     } else {
         gen_value(under_id, t, s)
@@ -308,7 +636,8 @@ fn gen_alias(tid: TypeId, under_id: TypeId, t: &Target, s: &mut State) -> Value
 }
 
 fn gen_res(res_tid: TypeId, tid: TypeId, t: &Target, s: &mut State) -> Value {
-    if let Some(res) = s.try_reuse_res(res_tid) {
+    let slot = t.res_slot_of(res_tid).unwrap();
+    if let Some(res) = s.try_reuse_res(slot) {
         res
     } else {
         gen_value(tid, t, s)
@@ -317,10 +646,10 @@ fn gen_res(res_tid: TypeId, tid: TypeId, t: &Target, s: &mut State) -> Value {
 
 fn gen_ptr(dir: PtrDir, tid: TypeId, t: &Target, s: &mut State) -> Value {
     if dir != PtrDir::In {
-        if t.is_res(tid) {
-            s.record_res(tid, false);
+        if let Some(slot) = t.res_slot_of(tid) {
+            s.record_res(slot, false);
         }
-        return Value::default_val(tid, t);
+        return Value::Scratch(scratch_len(tid, t, s.conf));
     }
 
     if thread_rng().gen::<f64>() >= 0.001 {
@@ -330,6 +659,16 @@ fn gen_ptr(dir: PtrDir, tid: TypeId, t: &Target, s: &mut State) -> Value {
     }
 }
 
+/// Number of elements of out buffer, 0 for types of fixed size.
+fn scratch_len(tid: TypeId, t: &Target, conf: &Config) -> usize {
+    match t.type_of(tid) {
+        TypeInfo::Alias { tid, .. } | TypeInfo::Res { tid } => scratch_len(*tid, t, conf),
+        TypeInfo::Slice { l, h, .. } => gen_slice_len(*l, *h),
+        TypeInfo::Str { .. } => conf.str_max_len,
+        _ => 0,
+    }
+}
+
 fn gen_flag(flags: &[Flag]) -> Value {
     assert!(!flags.is_empty());
 
@@ -380,7 +719,7 @@ fn gen_str(str_type: &StrType, vals: &Option<Vec<String>>, s: &mut State) -> Val
             return Value::Str(vals.choose(&mut rng).unwrap().clone());
         }
     }
-    if let Some(s) = s.try_reuse_str(str_type.clone()) {
+    if let Some(s) = s.try_reuse_str(str_type) {
         return s;
     }
 
@@ -423,6 +762,9 @@ fn gen_str(str_type: &StrType, vals: &Option<Vec<String>>, s: &mut State) -> Val
 
 fn gen_slice(tid: TypeId, l: isize, h: isize, t: &Target, s: &mut State) -> Value {
     let len: usize = gen_slice_len(l, h);
+    if is_byte(tid, t) {
+        return gen_bytes(t.num_info_of(tid).unwrap(), len);
+    }
     let mut vals = Vec::new();
 
     for _ in 0..len {
@@ -431,6 +773,24 @@ fn gen_slice(tid: TypeId, l: isize, h: isize, t: &Target, s: &mut State) -> Valu
     Value::Group(vals)
 }
 
+fn gen_bytes(num_info: &NumInfo, len: usize) -> Value {
+    let bytes = match num_info {
+        NumInfo::U8(NumLimit::None) | NumInfo::I8(NumLimit::None) => {
+            let mut bytes = vec![0; len];
+            thread_rng().fill(&mut bytes[..]);
+            bytes
+        }
+        _ => (0..len)
+            .map(|_| match gen_num(num_info) {
+                Value::Num(NumValue::Signed(n)) => n as u8,
+                Value::Num(NumValue::Unsigned(n)) => n as u8,
+                _ => unreachable!(),
+            })
+            .collect(),
+    };
+    Value::Bytes(bytes.into())
+}
+
 pub(crate) fn gen_slice_len(l: isize, h: isize) -> usize {
     match (l, h) {
         (-1, -1) => thread_rng().gen_range(1, 8),
@@ -539,12 +899,26 @@ fn gen_num(type_info: &NumInfo) -> Value {
 fn choose_seq(rs: &RTable, conf: &Config) -> Vec<usize> {
     assert!(!rs.is_empty());
 
-    // selection prability list
-    let mut sps = std::iter::repeat(1.0).take(rs.len()).collect::<Vec<_>>();
+    // selection prability list, disabled interfaces are never selected
+    let all_disabled = rs.enabled_num() == 0;
+    let weights = conf.call_weights.as_ref().filter(|w| w.len() == rs.len());
+    let mut sps = (0..rs.len())
+        .map(|i| {
+            if all_disabled || rs.is_enabled(i) {
+                1.0
+            } else {
+                0.0
+            }
+        })
+        .collect::<Vec<_>>();
     let mut seq = Vec::new();
     let mut i;
     while !should_stop(seq.len(), &conf) {
-        let index = choose_call(&sps);
+        // weights only bias the head calls, sps stay probabilities for push_deps
+        let index = match weights {
+            Some(w) => choose_call(&sps.iter().zip(w).map(|(p, w)| p * w).collect::<Vec<_>>()),
+            None => choose_call(&sps),
+        };
         sps[index] *= conf.sp_delta;
         seq.push(index);
         i = seq.len() - 1;
@@ -588,9 +962,9 @@ fn push_deps(rs: &RTable, seq: &mut Vec<usize>, mut i: usize, sps: &mut [f64], c
 
     while !should_stop(seq.len(), &conf) && i < seq.len() {
         call_index = seq[i];
-        for (j, r) in rs.index_axis(Axis(0), call_index).iter().enumerate() {
+        for j in 0..rs.len() {
             if call_index != j && random::<f64>() < sps[j] {
-                if *r == Relation::Some || random::<f64>() < 0.05 {
+                if random::<f64>() < rs.weight(call_index, j).max(0.05) {
                     sps[j] *= conf.sp_delta;
                     seq.push(j);
                 }
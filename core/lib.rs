@@ -7,6 +7,7 @@ extern crate lazy_static;
 
 pub mod analyze;
 pub mod c;
+pub mod encode;
 pub mod gen;
 pub mod minimize;
 pub mod mutate;
@@ -1,5 +1,8 @@
+use crate::gen::adjust_size_param;
 use crate::prog::{ArgIndex, Call, Prog};
-use crate::value::Value;
+use crate::target::Target;
+use crate::value::{NumValue, Value};
+use fots::types::{NumInfo, NumLimit, PtrDir, TypeId, TypeInfo};
 
 pub fn minimize<F>(p: &Prog, mut eq: F) -> Prog
 where
@@ -45,6 +48,151 @@ pub fn remove(p: &mut Prog, i: usize) -> bool {
     true
 }
 
+/// Apply the n-th applicable simplification of values of p: halve slice, str, bytes
+/// or out buffer, simplest num or null pointer. Return false if there are fewer places
+/// that can be simplified. Values of len type are adjusted after that.
+pub fn simplify(p: &mut Prog, t: &Target, mut n: usize) -> bool {
+    let mut done = false;
+    'outer: for c in p.calls.iter_mut() {
+        for arg in c.args.iter_mut() {
+            if simplify_val(arg.tid, &mut arg.val, t, &mut n) {
+                done = true;
+                break 'outer;
+            }
+        }
+    }
+    if done {
+        adjust_size_param(p, t);
+    }
+    done
+}
+
+// Count down places that can be simplified, until the n-th one is found.
+fn hit(n: &mut usize) -> bool {
+    if *n == 0 {
+        true
+    } else {
+        *n -= 1;
+        false
+    }
+}
+
+fn simplify_num(val: &mut Value, simplest: Value, n: &mut usize) -> bool {
+    match val {
+        Value::Num(_) if *val != simplest && hit(n) => {
+            *val = simplest;
+            true
+        }
+        _ => false,
+    }
+}
+
+/// Simplest value generation could make for num type, with the sign of the type:
+/// 0 if it's allowed, otherwise lower bound of range or least of given values.
+fn simplest_num(info: &NumInfo) -> Value {
+    fn least<T: Copy + Ord + Default>(l: &NumLimit<T>) -> T {
+        let zero = T::default();
+        match l {
+            NumLimit::Vals(vals) if !vals.contains(&zero) => {
+                vals.iter().copied().min().unwrap_or(zero)
+            }
+            NumLimit::Range(r) if !r.contains(&zero) => r.start,
+            _ => zero,
+        }
+    }
+
+    let signed = |n: i64| Value::Num(NumValue::Signed(n));
+    let unsigned = |n: u64| Value::Num(NumValue::Unsigned(n));
+    match info {
+        NumInfo::I8(l) => signed(i64::from(least(l))),
+        NumInfo::I16(l) => signed(i64::from(least(l))),
+        NumInfo::I32(l) => signed(i64::from(least(l))),
+        NumInfo::I64(l) => signed(least(l)),
+        NumInfo::Isize(l) => signed(least(l) as i64),
+        NumInfo::U8(l) => unsigned(u64::from(least(l))),
+        NumInfo::U16(l) => unsigned(u64::from(least(l))),
+        NumInfo::U32(l) => unsigned(u64::from(least(l))),
+        NumInfo::U64(l) => unsigned(least(l)),
+        NumInfo::Usize(l) => unsigned(least(l) as u64),
+    }
+}
+
+fn simplify_val(tid: TypeId, val: &mut Value, t: &Target, n: &mut usize) -> bool {
+    match t.type_of(tid) {
+        TypeInfo::Alias { tid, .. } => simplify_val(*tid, val, t, n),
+        TypeInfo::Res { tid } => match val {
+            Value::Ref(_) => false,
+            _ => simplify_val(*tid, val, t, n),
+        },
+        TypeInfo::Num(info) => simplify_num(val, simplest_num(info), n),
+        TypeInfo::Flag { flags, .. } => {
+            let least = flags.iter().map(|f| f.val).min().unwrap_or(0);
+            simplify_num(val, Value::Num(NumValue::Signed(least)), n)
+        }
+        TypeInfo::Ptr { dir, tid, .. } => match val {
+            Value::None => false,
+            Value::Scratch(len) => {
+                if *len > 1 && hit(n) {
+                    *len /= 2;
+                    true
+                } else {
+                    false
+                }
+            }
+            _ if *dir == PtrDir::In && hit(n) => {
+                *val = Value::None;
+                true
+            }
+            _ => simplify_val(*tid, val, t, n),
+        },
+        TypeInfo::Slice { tid, l, h } => {
+            let min_len = match (*l, *h) {
+                (-1, -1) => Some(1),
+                (_, -1) => None,
+                (l, _) => Some(l as usize),
+            };
+            let len = val.len().unwrap_or(0);
+            if let Some(min_len) = min_len {
+                if len > min_len && hit(n) {
+                    let len = min_len.max(len / 2);
+                    match val {
+                        Value::Group(vals) => vals.truncate(len),
+                        Value::Bytes(b) => b.truncate(len),
+                        _ => unreachable!(),
+                    }
+                    return true;
+                }
+            }
+            if let Value::Group(vals) = val {
+                vals.iter_mut().any(|v| simplify_val(*tid, v, t, n))
+            } else {
+                false
+            }
+        }
+        TypeInfo::Str { vals, .. } => match val {
+            // value chosen from given ones is kept
+            Value::Str(s) if vals.is_none() && s.len() > 1 && hit(n) => {
+                let len = s.chars().count() / 2;
+                *s = s.chars().take(len).collect();
+                true
+            }
+            _ => false,
+        },
+        TypeInfo::Struct { fields, .. } => match val {
+            Value::Group(vals) => fields
+                .iter()
+                .zip(vals.iter_mut())
+                .any(|(f, v)| simplify_val(f.tid, v, t, n)),
+            _ => false,
+        },
+        TypeInfo::Union { fields, .. } => match val {
+            Value::Opt { choice, val } => simplify_val(fields[*choice].tid, val, t, n),
+            _ => false,
+        },
+        TypeInfo::Len { .. } => false,
+    }
+}
+
 fn find_calls(p: &Prog, i: usize) -> Vec<usize> {
     let last_call = p.len() - 1;
     let mut result = vec![i];
@@ -91,7 +239,7 @@ fn for_each_ref<F: FnMut(&ArgIndex)>(val: &Value, f: F) {
     fn do_for_each_ref(val: &Value, f: &mut dyn FnMut(&ArgIndex)) {
         use Value::*;
         match val {
-            Num(_) | Str(_) | None => {}
+            Num(_) | Str(_) | Bytes(_) | Scratch(_) | None => {}
             Group(vals) => {
                 for v in vals.iter() {
                     do_for_each_ref(v, f)
@@ -113,7 +261,7 @@ fn for_each_ref_mut<F: FnMut(&mut ArgIndex)>(val: &mut Value, f: F) {
     fn do_for_each_ref_mut(val: &mut Value, f: &mut dyn FnMut(&mut ArgIndex)) {
         use Value::*;
         match val {
-            Num(_) | Str(_) | None => {}
+            Num(_) | Str(_) | Bytes(_) | Scratch(_) | None => {}
             Group(ref mut vals) => {
                 for v in vals.iter_mut() {
                     do_for_each_ref_mut(v, f)
@@ -1,31 +1,50 @@
 use crate::analyze::RTable;
-use crate::gen::{gen_seq, Config};
+use crate::gen::{gen_seq_with, Config, StrPool};
 use crate::prog::Prog;
 use crate::target::Target;
-use fots::types::GroupId;
+use fots::types::{FnId, GroupId};
 use rand::prelude::*;
-use std::collections::{HashMap, HashSet};
+use std::collections::HashMap;
+
+/// Progs that mutation can take calls from
+///
+/// Implementor should answer both queries without scanning all progs.
+pub trait SeedPool {
+    /// Random prog of group gid.
+    fn choose_in_group(&self, gid: GroupId) -> Option<&Prog>;
+    /// Random prog that contains call of fid.
+    fn choose_with_call(&self, fid: FnId) -> Option<&Prog>;
+}
 
 #[allow(clippy::type_complexity)]
-const MUTATE_METHOD: [fn(&Prog, &Target, &RTable, &HashSet<Prog>, &Config) -> Prog; 2] =
-    [seq_reuse, merge_seq /*remove_call*/];
+const MUTATE_METHOD: [fn(&Prog, &Target, &RTable, &dyn SeedPool, &mut StrPool, &Config) -> Prog;
+    3] = [seq_reuse, merge_seq, splice_call /*remove_call*/];
 
+/// Mutate seed p, which is chosen by caller, calls of other progs in pool may be merged.
 pub fn mutate(
-    corpus: &HashSet<Prog>,
+    p: &Prog,
+    pool: &dyn SeedPool,
     t: &Target,
     rt: &HashMap<GroupId, RTable>,
+    strs: &mut StrPool,
     conf: &Config,
 ) -> Prog {
     let mut rng = thread_rng();
-    let p = corpus.iter().choose(&mut rng).unwrap();
     let rt = &rt[&p.gid];
     let method = MUTATE_METHOD.choose(&mut rng).unwrap();
-    method(p, t, rt, corpus, conf)
+    method(p, t, rt, pool, strs, conf)
 }
 
-fn seq_reuse(p: &Prog, t: &Target, _rt: &RTable, _corpus: &HashSet<Prog>, conf: &Config) -> Prog {
+fn seq_reuse(
+    p: &Prog,
+    t: &Target,
+    _rt: &RTable,
+    _pool: &dyn SeedPool,
+    strs: &mut StrPool,
+    conf: &Config,
+) -> Prog {
     let seq = extract_seq(p, t);
-    gen_seq(&seq, p.gid, t, conf)
+    gen_seq_with(&seq, p.gid, t, strs, conf)
 }
 
 fn extract_seq(p: &Prog, t: &Target) -> Vec<usize> {
@@ -37,31 +56,63 @@ fn extract_seq(p: &Prog, t: &Target) -> Vec<usize> {
     seq
 }
 
-fn merge_seq(p0: &Prog, t: &Target, _rt: &RTable, corpus: &HashSet<Prog>, conf: &Config) -> Prog {
+fn merge_seq(
+    p0: &Prog,
+    t: &Target,
+    _rt: &RTable,
+    pool: &dyn SeedPool,
+    strs: &mut StrPool,
+    conf: &Config,
+) -> Prog {
     let mut rng = thread_rng();
     let merge_point = rng.gen_range(0, p0.len());
     let mut s0 = extract_seq(p0, t);
-    let p1 = corpus.iter().filter(|p1| p1.gid == p0.gid).choose(&mut rng);
-    if let Some(p1) = p1 {
+    if let Some(p1) = pool.choose_in_group(p0.gid) {
         let s1 = extract_seq(p1, t);
         let left = s0.split_off(merge_point + 1);
         s0.extend(s1);
         s0.extend(left);
     }
-    gen_seq(&s0, p0.gid, t, conf)
+    gen_seq_with(&s0, p0.gid, t, strs, conf)
+}
+
+/// Replace a call of p0 with calls leading to the same call in another prog,
+/// so the call is executed in a context that is known to be interesting.
+fn splice_call(
+    p0: &Prog,
+    t: &Target,
+    _rt: &RTable,
+    pool: &dyn SeedPool,
+    strs: &mut StrPool,
+    conf: &Config,
+) -> Prog {
+    let mut rng = thread_rng();
+    let splice_point = rng.gen_range(0, p0.len());
+    let fid = p0.calls[splice_point].fid;
+    let mut s0 = extract_seq(p0, t);
+    if let Some(p1) = pool.choose_with_call(fid) {
+        let pos = p1.calls.iter().rposition(|c| c.fid == fid).unwrap();
+        let mut s1 = extract_seq(p1, t);
+        s1.truncate(pos + 1);
+        let left = s0.split_off(splice_point + 1);
+        s0.truncate(splice_point);
+        s0.extend(s1);
+        s0.extend(left);
+    }
+    gen_seq_with(&s0, p0.gid, t, strs, conf)
 }
 
-// fn insert_call(p: &Prog, t: &Target, rt: &RTable, corpus: &[Prog], conf: &Config) -> Prog {
+// fn insert_call(p: &Prog, t: &Target, rt: &RTable, pool: &dyn SeedPool, conf: &Config) -> Prog {
 //     let seq = ex
 //     todo!()
 // }
 
-// fn remove_call(p: &Prog, t: &Target, rt: &RTable, corpus: &HashSet<Prog>, conf: &Config) -> Prog {
+// fn remove_call(p: &Prog, t: &Target, rt: &RTable, pool: &dyn SeedPool, conf: &Config) -> Prog {
 //     let mut rng = thread_rng();
 //     if p.len() <= 3 {
 //         let (_, methods) = MUTATE_METHOD.split_last().unwrap();
 //         let method = methods.choose(&mut rng).unwrap();
-//         return method(&p, t, rt, corpus, conf);
+//         return method(&p, t, rt, pool, conf);
 //     }
 //
 //     let mut p = p.clone();
@@ -76,7 +127,7 @@ fn merge_seq(p0: &Prog, t: &Target, _rt: &RTable, corpus: &HashSet<Prog>, conf:
 //         } else {
 //             let (_, methods) = MUTATE_METHOD.split_last().unwrap();
 //             let method = methods.choose(&mut rng).unwrap();
-//             return method(&p, t, rt, corpus, conf);
+//             return method(&p, t, rt, pool, conf);
 //         }
 //     }
 // }
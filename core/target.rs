@@ -1,12 +1,24 @@
 use std::collections::HashMap;
 
-use fots::types::{Field, FnId, FnInfo, Group, GroupId, Items, NumInfo, TypeId, TypeInfo};
+use crate::analyze::ResIndex;
+use fots::types::{
+    Field, FnId, FnInfo, Group, GroupId, Items, NumInfo, RuleInfo, TypeId, TypeInfo,
+};
 use std::ptr::NonNull;
 
 pub struct Target {
     pub types: HashMap<TypeId, TypeInfo>,
     pub groups: HashMap<GroupId, Group>,
     pub fns: HashMap<FnId, NonNull<FnInfo>>,
+    /// Producers and consumers of resources of each group.
+    pub res_index: HashMap<GroupId, ResIndex>,
+    /// Dense slot of each resource type, indexed by type id.
+    res_slots: Vec<Option<usize>>,
+    res_slot_num: usize,
+    pub rules: Vec<RuleInfo>,
+    /// Rules each fn appears in. Parser rejects rules calling fns of different
+    /// groups, such rules of items built otherwise are ignored.
+    rule_index: HashMap<FnId, Vec<usize>>,
 }
 
 impl Target {
@@ -29,7 +41,54 @@ impl Target {
             .collect();
         fns.shrink_to_fit();
 
-        Target { groups, types, fns }
+        let mut target = Target {
+            groups,
+            types,
+            fns,
+            res_index: HashMap::new(),
+            res_slots: Vec::new(),
+            res_slot_num: 0,
+            rules: items.rules,
+            rule_index: HashMap::new(),
+        };
+
+        let max_tid = target.types.keys().max().copied().unwrap_or(0);
+        let mut res_slots = vec![None; max_tid as usize + 1];
+        let mut res_slot_num = 0;
+        for tid in 0..=max_tid {
+            if target.types.contains_key(&tid) && target.is_res(tid) {
+                res_slots[tid as usize] = Some(res_slot_num);
+                res_slot_num += 1;
+            }
+        }
+        target.res_slots = res_slots;
+        target.res_slot_num = res_slot_num;
+
+        let mut res_index = target
+            .groups
+            .values()
+            .map(|g| (g.id, ResIndex::new(g, &target)))
+            .collect::<HashMap<_, _>>();
+        res_index.shrink_to_fit();
+        target.res_index = res_index;
+
+        let mut rule_index: HashMap<FnId, Vec<usize>> = HashMap::new();
+        for (i, r) in target.rules.iter().enumerate() {
+            let mut calls = r.iter_call().map(|c| c.fid);
+            let gid = target.fn_of(calls.next().unwrap()).gid;
+            if calls.all(|fid| target.fn_of(fid).gid == gid) {
+                for c in r.iter_call() {
+                    let rules = rule_index.entry(c.fid).or_default();
+                    if rules.last() != Some(&i) {
+                        rules.push(i);
+                    }
+                }
+            }
+        }
+        rule_index.shrink_to_fit();
+        target.rule_index = rule_index;
+
+        target
     }
 
     pub fn type_of(&self, tid: TypeId) -> &TypeInfo {
@@ -44,6 +103,11 @@ impl Target {
         self.groups.values()
     }
 
+    /// Rules calling fid.
+    pub fn rules_of(&self, fid: FnId) -> &[usize] {
+        self.rule_index.get(&fid).map(|r| &r[..]).unwrap_or(&[])
+    }
+
     pub fn is_res(&self, tid: TypeId) -> bool {
         match self.type_of(tid) {
             TypeInfo::Alias { tid, .. } => self.is_res(*tid),
@@ -52,6 +116,16 @@ impl Target {
         }
     }
 
+    /// Slot of resource type, None if tid is not resource.
+    #[inline]
+    pub fn res_slot_of(&self, tid: TypeId) -> Option<usize> {
+        self.res_slots.get(tid as usize).and_then(|s| *s)
+    }
+
+    pub fn res_slot_num(&self) -> usize {
+        self.res_slot_num
+    }
+
     pub fn is_str(&self, tid: TypeId) -> bool {
         match self.type_of(tid) {
             TypeInfo::Alias { tid, .. } => self.is_str(*tid),
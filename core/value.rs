@@ -1,13 +1,17 @@
 use rand::prelude::SliceRandom;
 use rand::{thread_rng, Rng};
 
-use fots::types::{TypeId, TypeInfo};
+use fots::types::{NumInfo, TypeId, TypeInfo};
+use serde::{Deserialize, Deserializer, Serialize, Serializer};
+use std::hash::{Hash, Hasher};
 
 use crate::gen::gen_slice_len;
 use crate::prog::ArgIndex;
 use crate::target::Target;
 
 /// Value of type
+///
+/// Persisted progs encode variants by index, new variants must be appended.
 #[derive(Clone, Debug, PartialEq, Eq, PartialOrd, Ord, Hash, Serialize, Deserialize)]
 pub enum Value {
     /// Value that stores num, both signed and unsigned but not bigger then 8 bytes
@@ -22,6 +26,10 @@ pub enum Value {
     Ref(ArgIndex),
     /// Nothing
     None,
+    /// Value of u8/i8 slice, one buffer instead of a value per byte
+    Bytes(ByteBuf),
+    /// Zeroed buffer that out pointer points to, number of elements of slice or str
+    Scratch(usize),
 }
 
 #[derive(Clone, Debug, PartialEq, Eq, PartialOrd, Ord, Hash, Serialize, Deserialize)]
@@ -50,6 +58,9 @@ impl Value {
             TypeInfo::Ptr { .. } => Value::None,
             TypeInfo::Slice { tid, l, h } => {
                 let len: usize = gen_slice_len(*l, *h);
+                if is_byte(*tid, t) {
+                    return Value::Bytes(vec![0; len].into());
+                }
                 let mut vals = Vec::new();
                 for _ in 0..len {
                     vals.push(Value::default_val(*tid, t));
@@ -85,6 +96,8 @@ impl Value {
     pub fn len(&self) -> Option<usize> {
         match self {
             Value::Str(s) => Some(s.len()),
+            Value::Bytes(b) => Some(b.len()),
+            Value::Scratch(n) => Some(*n),
             Value::Group(g) => Some(g.len()),
             _ => None,
         }
@@ -94,6 +107,10 @@ impl Value {
         match self {
             Value::Num(n) => n.literal(),
             Value::Str(s) => s.clone(),
+            Value::Bytes(b) => {
+                let b = b.iter().map(|b| b.to_string()).collect::<Vec<_>>();
+                format!("{{{}}}", b.join(","))
+            }
             Value::Group(vals) => {
                 use std::fmt::Write;
                 let mut buf = String::new();
@@ -108,6 +125,7 @@ impl Value {
                 buf.push('}');
                 buf
             }
+            Value::Scratch(_) => "{0}".into(),
             Value::Opt { val, .. } => val.literal(),
             Value::Ref(_) => unreachable!(),
             Value::None => "NULL".into(),
@@ -115,8 +133,132 @@ impl Value {
     }
 
     pub fn shrink(&mut self) {
-        if let Value::Group(v) = self {
-            v.shrink_to_fit()
+        match self {
+            Value::Group(v) => v.shrink_to_fit(),
+            Value::Bytes(b) => b.shrink_to_fit(),
+            _ => (),
+        }
+    }
+}
+
+/// Max length of byte buffer stored inline, ByteBuf then takes no more room than
+/// other variants of Value do.
+const INLINE_BYTES: usize = 30;
+
+/// Buffer of `Value::Bytes`. Short buffers, which most byte slices are, are stored
+/// inline without allocation. Encoded as plain bytes, the same as Vec<u8>.
+#[derive(Clone)]
+pub enum ByteBuf {
+    Inline(u8, [u8; INLINE_BYTES]),
+    Heap(Vec<u8>),
+}
+
+impl ByteBuf {
+    pub fn truncate(&mut self, len: usize) {
+        match self {
+            ByteBuf::Inline(l, _) => {
+                if len < *l as usize {
+                    *l = len as u8;
+                }
+            }
+            ByteBuf::Heap(b) => {
+                b.truncate(len);
+                if b.len() <= INLINE_BYTES {
+                    let inline = ByteBuf::from(&b[..]);
+                    *self = inline;
+                }
+            }
         }
     }
+
+    pub fn shrink_to_fit(&mut self) {
+        if let ByteBuf::Heap(b) = self {
+            b.shrink_to_fit();
+        }
+    }
+}
+
+impl std::ops::Deref for ByteBuf {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            ByteBuf::Inline(l, buf) => &buf[..*l as usize],
+            ByteBuf::Heap(b) => b,
+        }
+    }
+}
+
+impl From<&[u8]> for ByteBuf {
+    fn from(b: &[u8]) -> Self {
+        if b.len() <= INLINE_BYTES {
+            let mut buf = [0; INLINE_BYTES];
+            buf[..b.len()].copy_from_slice(b);
+            ByteBuf::Inline(b.len() as u8, buf)
+        } else {
+            ByteBuf::Heap(b.to_vec())
+        }
+    }
+}
+
+impl From<Vec<u8>> for ByteBuf {
+    fn from(b: Vec<u8>) -> Self {
+        if b.len() <= INLINE_BYTES {
+            ByteBuf::from(&b[..])
+        } else {
+            ByteBuf::Heap(b)
+        }
+    }
+}
+
+impl std::fmt::Debug for ByteBuf {
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        f.debug_list().entries(self.iter()).finish()
+    }
+}
+
+impl PartialEq for ByteBuf {
+    fn eq(&self, other: &Self) -> bool {
+        self[..] == other[..]
+    }
+}
+
+impl Eq for ByteBuf {}
+
+impl PartialOrd for ByteBuf {
+    fn partial_cmp(&self, other: &Self) -> Option<std::cmp::Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl Ord for ByteBuf {
+    fn cmp(&self, other: &Self) -> std::cmp::Ordering {
+        self[..].cmp(&other[..])
+    }
+}
+
+impl Hash for ByteBuf {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        self[..].hash(state)
+    }
+}
+
+impl Serialize for ByteBuf {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        s.serialize_bytes(self)
+    }
+}
+
+impl<'de> Deserialize<'de> for ByteBuf {
+    fn deserialize<D: Deserializer<'de>>(d: D) -> Result<Self, D::Error> {
+        Vec::<u8>::deserialize(d).map(ByteBuf::from)
+    }
+}
+
+/// Whether elements of slice of tid are stored as `Value::Bytes`.
+pub(crate) fn is_byte(tid: TypeId, t: &Target) -> bool {
+    match t.num_info_of(tid) {
+        Some(NumInfo::U8(_)) | Some(NumInfo::I8(_)) => true,
+        _ => false,
+    }
 }
@@ -1,3 +1,4 @@
+use crate::ExecResult;
 use nix::errno::Errno;
 use nix::sys::{mman, stat};
 use nix::{fcntl, libc, unistd, Result};
@@ -7,7 +8,17 @@ use std::ptr::NonNull;
 use std::{mem, ptr};
 
 pub const KCOV: &str = "/sys/kernel/debug/kcov";
-pub const KCOV_BUF_LEN: usize = 1024 * 1024 * 8;
+/// Flag set in length of coverage sent by generated prog, if trace of the call
+/// filled kcov buffer and the rest of it is lost.
+pub const COVER_OVERFLOW: u32 = 1 << 31;
+/// Length word of the message child sends once prog is compiled, followed by
+/// compile time in microseconds, so parent can tell compiling from running.
+pub const COMPILED_MSG: u32 = 1 << 30;
+/// Bounds of entries of kcov buffer.
+pub const COVER_SIZE_MIN: usize = 64 * 1024;
+pub const COVER_SIZE_MAX: usize = 4 * 1024 * 1024;
+/// Execs whose traces fit in a quarter of kcov buffer before it shrinks.
+const SHRINK_INTERVAL: usize = 128;
 
 const KCOV_MAGIC: u8 = b'c';
 const KCOV_INIT_TRACE: u8 = 1;
@@ -35,12 +46,15 @@ unsafe fn kcov_disable(fd: RawFd) -> Result<libc::c_int> {
 
 pub struct CovHandle {
     fd: RawFd,
+    /// Entries of buffer, including the leading length.
+    size: usize,
     pcs: NonNull<usize>,
     len: NonNull<usize>,
     mem: NonNull<c_void>,
 }
 
-pub fn open() -> CovHandle {
+/// Open kcov with buffer of size entries.
+pub fn open(size: usize) -> CovHandle {
     let fd = fcntl::open(KCOV, fcntl::OFlag::O_RDWR, stat::Mode::empty())
         .unwrap_or_else(|e| exits!(exitcode::OSERR, "Fail to open {}: {}", KCOV, e));
 
@@ -48,12 +62,12 @@ pub fn open() -> CovHandle {
         use mman::MapFlags;
         use mman::ProtFlags;
 
-        kcov_init(fd, KCOV_BUF_LEN / mem::size_of::<usize>())
+        kcov_init(fd, size)
             .unwrap_or_else(|e| exits!(exitcode::OSERR, "Fail to init kcov trace: {}", e));
 
         let mem = mman::mmap(
             ptr::null_mut(),
-            KCOV_BUF_LEN,
+            size * mem::size_of::<usize>(),
             ProtFlags::PROT_READ | ProtFlags::PROT_WRITE,
             MapFlags::MAP_SHARED,
             fd,
@@ -66,6 +80,7 @@ pub fn open() -> CovHandle {
         let pcs = cover.add(1);
         CovHandle {
             fd,
+            size,
             pcs: NonNull::new(pcs).unwrap(),
             len: NonNull::new(len).unwrap(),
             mem: NonNull::new(mem).unwrap(),
@@ -81,6 +96,11 @@ impl CovHandle {
         self.covers()
     }
 
+    /// Whether trace of last call filled the buffer.
+    pub fn is_full(&self) -> bool {
+        unsafe { *self.len.as_ref() >= self.size - 1 }
+    }
+
     fn clear(&mut self) {
         unsafe {
             *self.len.as_mut() = 0;
@@ -106,7 +126,7 @@ impl CovHandle {
 impl Drop for CovHandle {
     fn drop(&mut self) {
         unsafe {
-            mman::munmap(self.mem.as_ptr(), KCOV_BUF_LEN)
+            mman::munmap(self.mem.as_ptr(), self.size * mem::size_of::<usize>())
                 .unwrap_or_else(|e| exits!(exitcode::OSERR, "Fail to munmap kcov: {}", e));
         }
         unistd::close(self.fd).unwrap_or_else(|e| exits!(exitcode::OSERR, "Fail to close: {}", e));
@@ -125,3 +145,47 @@ impl<'a> Drop for Guard<'a> {
         }
     }
 }
+
+/// Entries of kcov buffer used by each exec of a worker. Most calls only trace a
+/// few thousand pcs, so buffer starts small, doubles once a call fills it and
+/// halves after SHRINK_INTERVAL execs using less than a quarter of it.
+#[derive(Debug)]
+pub struct CoverSize {
+    size: usize,
+    small_execs: usize,
+}
+
+impl Default for CoverSize {
+    fn default() -> Self {
+        Self {
+            size: COVER_SIZE_MIN * 4,
+            small_execs: 0,
+        }
+    }
+}
+
+impl CoverSize {
+    pub fn get(&self) -> usize {
+        self.size
+    }
+
+    pub fn update(&mut self, r: &ExecResult) {
+        if let ExecResult::Ok(covs, truncated) = r {
+            if !truncated.is_empty() {
+                self.size = (self.size * 2).min(COVER_SIZE_MAX);
+                self.small_execs = 0;
+                return;
+            }
+            let longest = covs.iter().map(|c| c.len()).max().unwrap_or(0);
+            if longest < self.size / 4 {
+                self.small_execs += 1;
+                if self.small_execs == SHRINK_INTERVAL {
+                    self.size = (self.size / 2).max(COVER_SIZE_MIN);
+                    self.small_execs = 0;
+                }
+            } else {
+                self.small_execs = 0;
+            }
+        }
+    }
+}
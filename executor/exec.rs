@@ -1,13 +1,17 @@
+use crate::cover::{CoverSize, COMPILED_MSG, COVER_OVERFLOW};
+use crate::utils::pidfd;
 use crate::Config;
 use byte_slice_cast::*;
 use byteorder::*;
 use core::prog::Prog;
 use core::target::Target;
+use nix::errno::Errno;
 use nix::fcntl::{fcntl, FcntlArg};
 use nix::poll::{poll, PollFd, PollFlags};
 use nix::sys::signal::{kill, Signal};
-use nix::sys::wait::{wait, waitpid, WaitPidFlag};
+use nix::sys::wait::{wait, waitpid, WaitPidFlag, WaitStatus};
 use nix::unistd::{dup2, fork, ForkResult, Pid};
+use nix::Error;
 use os_pipe::PipeWriter;
 use rand::random;
 use serde::{Deserialize, Serialize};
@@ -15,15 +19,22 @@ use std::collections::HashSet;
 use std::fmt;
 use std::fs::{read_to_string, write};
 use std::io::Read;
-use std::mem;
 use std::ops::Index;
+use std::os::raw::c_int;
 use std::os::unix::io::AsRawFd;
 use std::path::PathBuf;
 use std::process::exit;
 use std::thread::sleep;
-use std::time::Duration;
+use std::time::{Duration, Instant};
 
-pub fn fork_exec(p: Prog, t: &Target, conf: &Config) -> ExecResult {
+/// Exec p in a forked child, return result with time spent in each step.
+#[cfg_attr(not(feature = "kcov"), allow(unused_variables))]
+pub fn fork_exec(
+    p: Prog,
+    t: &Target,
+    conf: &Config,
+    pool: &mut CovPool,
+) -> (ExecResult, ExecTimes) {
     if conf.concurrency || random::<f64>() < 0.0025 {
         bg_run(&p, t);
     }
@@ -71,7 +82,7 @@ pub fn fork_exec(p: Prog, t: &Target, conf: &Config) -> ExecResult {
             });
             drop(err_wp);
             #[cfg(feature = "kcov")]
-            sync_exec(&p, t, &mut wp, waiter, conf);
+            sync_exec(&p, t, &mut wp, waiter, conf, pool.cover_size());
             #[cfg(not(feature = "kcov"))]
             sync_exec(&p, t);
             // subprocess exits here
@@ -83,13 +94,14 @@ pub fn fork_exec(p: Prog, t: &Target, conf: &Config) -> ExecResult {
             #[cfg(feature = "kcov")]
             drop(waiter);
 
+            let mut times = ExecTimes::default();
             #[cfg(feature = "kcov")]
-            let ret = watch(child, &mut rp, &mut err_rp, notifer, conf);
+            let ret = watch(child, &mut rp, &mut err_rp, notifer, conf, pool, &mut times);
 
             #[cfg(not(feature = "kcov"))]
-            let ret = watch(child, &mut err_rp);
+            let ret = watch(child, &mut err_rp, &mut times);
 
-            ret
+            (ret, times)
         }
         Err(e) => exits!(exitcode::OSERR, "Fail to fork: {}", e),
     }
@@ -113,22 +125,8 @@ fn bg_run(p: &Prog, t: &Target) {
                     }
                 }
 
-                const SLEEP_DURATION: Duration = Duration::from_millis(100);
                 const WAIT_TIME: Duration = Duration::from_secs(30);
-
-                let mut wait_time = Duration::new(0, 0);
-                while !childs.is_empty() && wait_time < WAIT_TIME {
-                    sleep(SLEEP_DURATION);
-                    wait_time += SLEEP_DURATION;
-
-                    if let Ok(status) = waitpid(None, Some(WaitPidFlag::WNOHANG)) {
-                        if let Some(pid) = status.pid() {
-                            childs.remove(&pid);
-                        }
-                    } else {
-                        break;
-                    }
-                }
+                let childs = wait_childs(childs, WAIT_TIME);
 
                 for pid in childs.iter() {
                     kill_and_wait(*pid)
@@ -152,24 +150,10 @@ fn bg_fork_run(p: &Prog, t: &Target) {
 
     match fork() {
         Ok(ForkResult::Parent { child }) => {
-            const SLEEP_DURATION: Duration = Duration::from_millis(100);
             const WAIT_TIME: Duration = Duration::from_secs(10);
-
-            let mut waited_time = Duration::new(0, 0);
-            while waited_time < WAIT_TIME {
-                sleep(SLEEP_DURATION);
-                waited_time += SLEEP_DURATION;
-
-                match waitpid(child, Some(WaitPidFlag::WNOHANG)) {
-                    Ok(status) => {
-                        if status.pid().is_some() {
-                            exit(0)
-                        }
-                    }
-                    Err(_) => break,
-                }
+            if !wait_childs(hashset! {child}, WAIT_TIME).is_empty() {
+                kill_and_wait(child);
             }
-            kill_and_wait(child);
             exit(0)
         }
         Ok(ForkResult::Child) => {
@@ -182,30 +166,147 @@ fn bg_fork_run(p: &Prog, t: &Target) {
     }
 }
 
+/// Wait for exit of childs until timeout, return childs still alive.
+/// Exit of childs is polled with pid fds, so waiting ends as soon as all childs exit.
+fn wait_childs(mut childs: HashSet<Pid>, timeout: Duration) -> HashSet<Pid> {
+    let start = Instant::now();
+    let pidfds = childs
+        .iter()
+        .map(|&pid| pidfd(pid))
+        .collect::<Option<Vec<_>>>();
+    let mut pidfds = match pidfds {
+        Some(pidfds) => pidfds,
+        None => return wait_childs_polling(childs, timeout),
+    };
+
+    while !pidfds.is_empty() {
+        let remaining = match timeout.checked_sub(start.elapsed()) {
+            Some(remaining) => remaining,
+            None => break,
+        };
+        let mut fds = pidfds
+            .iter()
+            .map(|fd| PollFd::new(fd.as_raw_fd(), PollFlags::POLLIN))
+            .collect::<Vec<_>>();
+        match poll(&mut fds, remaining.as_millis() as c_int) {
+            Ok(0) => break,
+            Ok(_) => {
+                let exited = pidfds
+                    .iter()
+                    .zip(fds.iter())
+                    .filter(|(_, fd)| fd.revents().map(|r| !r.is_empty()).unwrap_or(false))
+                    .map(|(pidfd, _)| pidfd.pid)
+                    .collect::<Vec<_>>();
+                for pid in exited.iter() {
+                    // reap it
+                    waitpid(*pid, Some(WaitPidFlag::WNOHANG)).ok();
+                    childs.remove(pid);
+                }
+                pidfds.retain(|fd| !exited.contains(&fd.pid));
+            }
+            Err(Error::Sys(Errno::EINTR)) => continue,
+            Err(_) => break,
+        }
+    }
+    childs
+}
+
+/// Wait child to exit in timeout and reap it, None if it's still running.
+pub(crate) fn wait_child(child: Pid, timeout: Duration) -> Option<WaitStatus> {
+    match pidfd(child) {
+        Some(fd) => {
+            let start = Instant::now();
+            let mut fds = [PollFd::new(fd.as_raw_fd(), PollFlags::POLLIN)];
+            loop {
+                let remaining = timeout.checked_sub(start.elapsed())?;
+                match poll(&mut fds, remaining.as_millis() as c_int) {
+                    Ok(0) => return None,
+                    Ok(_) => return waitpid(child, None).ok(),
+                    Err(Error::Sys(Errno::EINTR)) => continue,
+                    Err(_) => return None,
+                }
+            }
+        }
+        None => wait_child_polling(child, timeout),
+    }
+}
+
+/// Fallback of wait_child for kernel without pidfd.
+fn wait_child_polling(child: Pid, timeout: Duration) -> Option<WaitStatus> {
+    const SLEEP_DURATION: Duration = Duration::from_millis(10);
+
+    let start = Instant::now();
+    while start.elapsed() < timeout {
+        match waitpid(child, Some(WaitPidFlag::WNOHANG)) {
+            Ok(WaitStatus::StillAlive) => sleep(SLEEP_DURATION),
+            Ok(status) => return Some(status),
+            Err(_) => return None,
+        }
+    }
+    None
+}
+
+/// Fallback of wait_childs for kernel without pidfd.
+fn wait_childs_polling(mut childs: HashSet<Pid>, timeout: Duration) -> HashSet<Pid> {
+    const SLEEP_DURATION: Duration = Duration::from_millis(10);
+
+    let start = Instant::now();
+    while !childs.is_empty() && start.elapsed() < timeout {
+        match waitpid(None, Some(WaitPidFlag::WNOHANG)) {
+            Ok(WaitStatus::StillAlive) => sleep(SLEEP_DURATION),
+            Ok(status) => {
+                if let Some(pid) = status.pid() {
+                    childs.remove(&pid);
+                }
+            }
+            Err(_) => break,
+        }
+    }
+    childs
+}
+
+/// Compiling is not told apart from running here, both are counted as exec.
 #[cfg(not(feature = "kcov"))]
-fn watch<T: Read + AsRawFd>(child: Pid, err: &mut T) -> ExecResult {
+fn watch<T: Read + AsRawFd>(child: Pid, err: &mut T, times: &mut ExecTimes) -> ExecResult {
+    let start = Instant::now();
+    let ret = do_watch(child, err);
+    times.exec = micros(start.elapsed());
+    ret
+}
+
+#[cfg(not(feature = "kcov"))]
+fn do_watch<T: Read + AsRawFd>(child: Pid, err: &mut T) -> ExecResult {
     let mut fds = vec![PollFd::new(err.as_raw_fd(), PollFlags::POLLIN)];
+    let start = Instant::now();
 
-    match poll(&mut fds, 5_000) {
-        Ok(0) => {
-            kill_and_wait(child);
-            ExecResult::Failed(Reason(String::from("Time out")))
-        }
-        Ok(_) => {
-            assert!(fds[0].revents().is_some() && !fds[0].revents().unwrap().is_empty());
-            kill_and_wait(child);
-            let mut err_msg = Vec::new();
-            err.read_to_end(&mut err_msg).unwrap();
-            if err_msg.is_empty() {
-                ExecResult::Ok(Default::default())
-            } else {
-                ExecResult::Failed(Reason(String::from_utf8(err_msg).unwrap()))
+    loop {
+        let remaining = Duration::from_secs(5)
+            .checked_sub(start.elapsed())
+            .unwrap_or_default();
+        match poll(&mut fds, remaining.as_millis() as c_int) {
+            Ok(0) => {
+                kill_and_wait(child);
+                return ExecResult::Failed(Reason(String::from("Time out")));
             }
+            Ok(_) => {
+                assert!(fds[0].revents().is_some() && !fds[0].revents().unwrap().is_empty());
+                kill_and_wait(child);
+                let mut err_msg = Vec::new();
+                err.read_to_end(&mut err_msg).unwrap();
+                return if err_msg.is_empty() {
+                    ExecResult::Ok(Default::default(), Vec::new())
+                } else {
+                    ExecResult::Failed(Reason(String::from_utf8(err_msg).unwrap()))
+                };
+            }
+            Err(Error::Sys(Errno::EINTR)) => continue,
+            Err(e) => exits!(exitcode::SOFTWARE, "Fail to poll: {}", e),
         }
-        Err(e) => exits!(exitcode::SOFTWARE, "Fail to poll: {}", e),
     }
 }
 
+/// Exec time is counted from the compiled message of child, or from fork if
+/// child fails before it.
 #[cfg(feature = "kcov")]
 fn watch<T: Read + AsRawFd>(
     child: Pid,
@@ -213,14 +314,44 @@ fn watch<T: Read + AsRawFd>(
     err: &mut T,
     notifer: crate::utils::Notifier,
     conf: &Config,
+    pool: &mut CovPool,
+    times: &mut ExecTimes,
+) -> ExecResult {
+    let mut exec_start = Instant::now();
+    let ret = do_watch(
+        child,
+        data,
+        err,
+        notifer,
+        conf,
+        pool,
+        times,
+        &mut exec_start,
+    );
+    times.exec = micros(exec_start.elapsed()).saturating_sub(times.cover);
+    ret
+}
+
+#[cfg(feature = "kcov")]
+#[allow(clippy::too_many_arguments)]
+fn do_watch<T: Read + AsRawFd>(
+    child: Pid,
+    data: &mut T,
+    err: &mut T,
+    notifer: crate::utils::Notifier,
+    conf: &Config,
+    pool: &mut CovPool,
+    times: &mut ExecTimes,
+    exec_start: &mut Instant,
 ) -> ExecResult {
     let mut fds = vec![
         PollFd::new(data.as_raw_fd(), PollFlags::POLLIN),
         PollFd::new(err.as_raw_fd(), PollFlags::POLLIN),
     ];
     let mut covs = Vec::new();
+    let mut truncated = Vec::new();
     let wait_timeout = if conf.memleak_check { 3000 } else { 1000 };
-    let mut wait_time = Duration::from_secs(0);
+    let start = Instant::now();
 
     loop {
         match poll(&mut fds, wait_timeout) {
@@ -230,13 +361,10 @@ fn watch<T: Read + AsRawFd>(
                 return if covs.is_empty() {
                     ExecResult::Failed(Reason(String::from("Time out")))
                 } else {
-                    covs.shrink_to_fit();
-                    ExecResult::Ok(covs)
+                    ExecResult::Ok(covs, truncated)
                 };
             }
             Ok(_) => {
-                wait_time += Duration::from_millis(wait_timeout as u64);
-
                 if let Some(revents) = fds[1].revents() {
                     if !revents.is_empty() {
                         kill_and_wait(child);
@@ -246,7 +374,6 @@ fn watch<T: Read + AsRawFd>(
                         return if covs.is_empty() {
                             ExecResult::Failed(Reason(String::from_utf8(err_msg).unwrap()))
                         } else {
-                            covs.shrink_to_fit();
                             if conf.memleak_check {
                                 if let Some(leak) = check_leak(child.to_string()) {
                                     return ExecResult::Failed(Reason(format!(
@@ -255,7 +382,7 @@ fn watch<T: Read + AsRawFd>(
                                     )));
                                 }
                             }
-                            ExecResult::Ok(covs)
+                            ExecResult::Ok(covs, truncated)
                         };
                     }
                 }
@@ -266,28 +393,38 @@ fn watch<T: Read + AsRawFd>(
                         let len = data.read_u32::<NativeEndian>().unwrap_or_else(|e| {
                             exits!(exitcode::OSERR, "Fail to read length of covs: {}", e)
                         });
-                        let len = len as usize * mem::size_of::<usize>();
-                        let mut buf = bytes::BytesMut::with_capacity(len);
-                        unsafe {
-                            buf.set_len(len);
+                        if len == COMPILED_MSG {
+                            times.compile = data.read_u32::<NativeEndian>().unwrap_or_else(|e| {
+                                exits!(exitcode::OSERR, "Fail to read compile time: {}", e)
+                            });
+                            *exec_start = Instant::now();
+                            continue;
                         }
-                        data.read_exact(&mut buf).unwrap_or_else(|e| {
-                            exits!(exitcode::IOERR, "Fail to read covs(len {}): {}", len, e)
-                        });
+                        let cover_start = Instant::now();
+                        if len & COVER_OVERFLOW != 0 {
+                            truncated.push(covs.len());
+                        }
+                        let len = len & !COVER_OVERFLOW;
+                        let mut new_cov = pool.get(len as usize);
+                        data.read_exact(new_cov.as_mut_byte_slice())
+                            .unwrap_or_else(|e| {
+                                exits!(exitcode::IOERR, "Fail to read covs(len {}): {}", len, e)
+                            });
                         notifer.notify();
 
-                        let mut new_cov = Vec::from(buf.as_ref().as_slice_of::<usize>().unwrap());
-                        new_cov.shrink_to_fit();
                         covs.push(new_cov);
+                        times.cover += micros(cover_start.elapsed());
                     }
                 }
             }
-            Err(_) => {
-                wait_time += Duration::from_millis(wait_timeout as u64);
-                if wait_time > Duration::from_secs(10) {
+            Err(Error::Sys(Errno::EINTR)) => {
+                // Interrupted by signal, poll again unless exec is too long.
+                if start.elapsed() > Duration::from_secs(10) {
+                    kill_and_wait(child);
                     return ExecResult::Failed(Reason("Time out".to_string()));
                 }
             }
+            Err(e) => exits!(exitcode::SOFTWARE, "Fail to poll: {}", e),
         }
     }
 }
@@ -341,17 +478,66 @@ fn parse_leak(leaks_src: &str) -> Vec<&str> {
 
 // Following result is ignored because we know that we are killing correct sub process.
 #[allow(unused_must_use)]
-fn kill_and_wait(child: Pid) {
+pub(crate) fn kill_and_wait(child: Pid) {
     kill(child, Some(Signal::SIGKILL));
     waitpid(child, None);
 }
 
+/// Coverage buffers of sent results, reused by following execs, so reading
+/// coverage of a call doesn't allocate once the pool is warm. Size of kcov
+/// buffer of generated progs also follows the results.
+#[derive(Debug, Default)]
+pub struct CovPool {
+    bufs: Vec<Vec<usize>>,
+    size: CoverSize,
+}
+
+impl CovPool {
+    /// Entries of kcov buffer of next exec.
+    pub fn cover_size(&self) -> usize {
+        self.size.get()
+    }
+
+    /// Buffer of len zeroed elements.
+    fn get(&mut self, len: usize) -> Vec<usize> {
+        let mut buf = self.bufs.pop().unwrap_or_default();
+        buf.clear();
+        buf.resize(len, 0);
+        buf
+    }
+
+    /// Take back coverage buffers of a result that has been sent.
+    pub fn recycle(&mut self, r: ExecResult) {
+        self.size.update(&r);
+        if let ExecResult::Ok(covs, _) = r {
+            self.bufs.extend(covs);
+        }
+    }
+}
+
 #[derive(Debug, Clone, Serialize, Deserialize)]
 pub enum ExecResult {
-    Ok(Vec<Vec<usize>>),
+    /// Coverage of each executed call, and index of calls whose coverage is
+    /// truncated because their traces filled kcov buffer.
+    Ok(Vec<Vec<usize>>, Vec<usize>),
     Failed(Reason),
 }
 
+/// Time spent by executor on each step of an exec, in microseconds.
+#[derive(Debug, Clone, Copy, Default, Serialize, Deserialize)]
+pub struct ExecTimes {
+    /// Instrumenting and compiling prog in child.
+    pub compile: u32,
+    /// Running compiled prog, until child exits or times out.
+    pub exec: u32,
+    /// Reading and filtering coverage of calls.
+    pub cover: u32,
+}
+
+pub(crate) fn micros(d: Duration) -> u32 {
+    d.as_micros().min(u128::from(u32::max_value())) as u32
+}
+
 #[derive(Serialize, Deserialize, Debug, Clone)]
 pub struct Reason(pub String);
 
@@ -374,6 +560,7 @@ pub fn sync_exec(
     out: &mut PipeWriter,
     waiter: crate::utils::Waiter,
     conf: &Config,
+    cover_size: usize,
 ) {
     if conf.memleak_check {
         mem_leak_clear();
@@ -383,7 +570,7 @@ pub fn sync_exec(
     use jit::exec;
     #[cfg(feature = "syscall")]
     use syscall::exec;
-    exec(p, t, out, waiter);
+    exec(p, t, out, waiter, cover_size);
 }
 
 #[cfg(not(feature = "kcov"))]
@@ -1,3 +1,5 @@
+use crate::cover::{COMPILED_MSG, COVER_OVERFLOW};
+use crate::exec::micros;
 use crate::utils::Waiter;
 use core::c;
 use core::c::cths::CTHS;
@@ -9,17 +11,21 @@ use std::ffi::CString;
 use std::fmt::Write;
 use std::fs::{create_dir_all, write};
 use std::io::ErrorKind;
+use std::io::Write as _;
 use std::os::raw::c_int;
 use std::os::unix::io::*;
 use std::path::PathBuf;
 use std::process::exit;
+use std::time::Instant;
 use tcc::{Context, Guard};
 
 #[cfg(feature = "kcov")]
-pub fn exec(p: &Prog, t: &Target, out: &mut PipeWriter, waiter: Waiter) {
+pub fn exec(p: &Prog, t: &Target, out: &mut PipeWriter, waiter: Waiter, cover_size: usize) {
+    let start = Instant::now();
     prepare_env();
     let p = {
-        instrument_prog(p, t, out.as_raw_fd(), waiter.as_raw_fd()).unwrap_or_else(|e| {
+        let (data_fd, sync_fd) = (out.as_raw_fd(), waiter.as_raw_fd());
+        instrument_prog(p, t, data_fd, sync_fd, cover_size).unwrap_or_else(|e| {
             eprintln!("{}", e);
             exit(exitcode::SOFTWARE);
         })
@@ -45,6 +51,12 @@ pub fn exec(p: &Prog, t: &Target, out: &mut PipeWriter, waiter: Waiter) {
         std::mem::transmute(symbol)
     };
 
+    let mut msg = [0; 8];
+    msg[..4].copy_from_slice(&COMPILED_MSG.to_ne_bytes());
+    msg[4..].copy_from_slice(&micros(start.elapsed()).to_ne_bytes());
+    out.write_all(&msg)
+        .unwrap_or_else(|e| exits!(exitcode::OSERR, "Fail to send compile time: {}", e));
+
     let code = execute();
     if code != 0 {
         exits!(
@@ -105,6 +117,7 @@ pub fn instrument_prog(
     t: &Target,
     data_fd: RawFd,
     sync_fd: RawFd,
+    cover_size: usize,
 ) -> Result<String, String> {
     let mut includes = hashset! {
         "stdio.h".to_string(),
@@ -120,13 +133,17 @@ pub fn instrument_prog(
         "string.h".to_string()
     };
 
-    let macros = r#"
+    let macros = format!(
+        r#"
 #define KCOV_INIT_TRACE  _IOR('c', 1, unsigned long)
 #define KCOV_ENABLE      _IO('c', 100)
 #define KCOV_DISABLE     _IO('c', 101)
-#define COVER_SIZE       1024*1024
+#define COVER_SIZE       {}
+#define COVER_OVERFLOW   {}u
 #define KCOV_TRACE_PC    0
-    "#;
+    "#,
+        cover_size, COVER_OVERFLOW
+    );
 
     let sync_send = format!(
         r#"
@@ -139,8 +156,10 @@ int sync_send(unsigned long *cover, uint32_t len){{
     int event_fd = {}, data_fd = {};
     char l[4];
     char event[8];
+    // first entry is length, trace is cut once it reaches end of buffer
+    uint32_t head = len >= COVER_SIZE - 1 ? (len | COVER_OVERFLOW) : len;
 
-    memcpy(l, &len, 4);
+    memcpy(l, &head, 4);
     if (write(data_fd, l, 4) == -1){{
         return -1;
     }}
@@ -293,7 +312,7 @@ impl From<i32> for StatusCode {
 
 const TCC_INCLUDE: &str = "/usr/local/include/healer/tcc";
 
-fn new_tcc<'a, 'b>(g: &'a mut Guard) -> Context<'a, 'b> {
+pub(crate) fn new_tcc<'a, 'b>(g: &'a mut Guard) -> Context<'a, 'b> {
     let mut cc = tcc::Context::new(g).unwrap();
     cc.add_sys_include_path(TCC_INCLUDE);
     if cfg!(target_os = "linux") {
@@ -313,7 +332,7 @@ fn new_tcc<'a, 'b>(g: &'a mut Guard) -> Context<'a, 'b> {
     cc
 }
 
-fn prepare_env() {
+pub(crate) fn prepare_env() {
     let float_h = include_str!("../tcc-0.9.27/include/float.h");
     let stdarg_h = include_str!("../tcc-0.9.27/include/stdarg.h");
     let stdbool_h = include_str!("../tcc-0.9.27/include/stdbool.h");
@@ -4,7 +4,7 @@ use core::target::Target;
 use os_pipe::PipeWriter;
 
 #[cfg(feature = "kcov")]
-pub fn exec(_p: &Prog, _t: &Target, _out: &mut PipeWriter, _waiter: Waiter) {
+pub fn exec(_p: &Prog, _t: &Target, _out: &mut PipeWriter, _waiter: Waiter, _cover_size: usize) {
     todo!()
 }
 
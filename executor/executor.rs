@@ -1,5 +1,5 @@
 use core::target::Target;
-use executor::{exec_loop, Config};
+use executor::{exec_loop, probe, Config};
 use fots::types::Items;
 use std::fs::{read, write};
 use std::net::TcpStream;
@@ -23,6 +23,10 @@ pub struct Settings {
 
     #[structopt(short = "m", long = "memleak-check")]
     memleak_check: bool,
+
+    /// Probe interfaces and send disabled ones before executing progs
+    #[structopt(short = "p", long)]
+    probe: bool,
 }
 
 fn main() {
@@ -43,7 +47,7 @@ fn main() {
     }
 
     let mut retry = 1;
-    let conn = loop {
+    let mut conn = loop {
         match TcpStream::connect(&settings.addr) {
             Ok(c) => break c,
             Err(e) => {
@@ -58,6 +62,13 @@ fn main() {
         }
     };
 
+    if settings.probe {
+        probe::probe(&target, &mut conn).unwrap_or_else(|e| {
+            eprintln!("Fail to probe:{}", e);
+            exit(exitcode::SOFTWARE);
+        });
+    }
+
     let conf = Config {
         memleak_check: settings.memleak_check,
         concurrency: settings.concurrency,
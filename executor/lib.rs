@@ -14,9 +14,10 @@ mod utils;
 pub mod cover;
 #[allow(unused_imports, unused_mut, dead_code)]
 pub mod exec;
+pub mod probe;
 pub mod transfer;
 
-pub use exec::{ExecResult, Reason};
+pub use exec::{CovPool, ExecResult, ExecTimes, Reason};
 
 pub struct Config {
     pub memleak_check: bool,
@@ -25,13 +26,19 @@ pub struct Config {
 
 /// Read prog from conn, translate by target, run the translated test program.
 pub fn exec_loop<T: Read + Write>(t: Target, mut conn: T, conf: Config) {
+    // Buffers live as long as the connection, so each exec reuses them.
+    let mut recv_buf = Vec::new();
+    let mut send_buf = Vec::new();
+    let mut pool = CovPool::default();
     loop {
-        let p = transfer::recv_prog(&mut conn)
+        let p = transfer::recv_prog_with(&mut conn, &t, &mut recv_buf)
             .unwrap_or_else(|e| exits!(exitcode::SOFTWARE, "Fail to recv:{}", e));
 
-        let result = exec::fork_exec(p, &t, &conf);
+        // Timings go along with result, so fuzzer can see where exec time goes.
+        let reply = exec::fork_exec(p, &t, &conf, &mut pool);
 
-        transfer::send(&result, &mut conn)
-            .unwrap_or_else(|e| exits!(exitcode::SOFTWARE, "Fail to Send {:?}:{}", result, e));
+        transfer::send_with(&reply, &mut conn, &mut send_buf)
+            .unwrap_or_else(|e| exits!(exitcode::SOFTWARE, "Fail to Send {:?}:{}", reply, e));
+        pool.recycle(reply.0);
     }
 }
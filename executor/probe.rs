@@ -0,0 +1,107 @@
+//! Probe
+//!
+//! Interfaces whose generated code can't be compiled, can't be linked or
+//! whose syscall is not implemented by kernel only waste executions.
+//! Every interface is checked once at startup with a single call prog,
+//! the fuzzer masks out the ones that failed.
+//!
+//! Fuzzer sends interfaces probed before, the rest are probed one by one,
+//! each reported to fuzzer before and after it runs. If a probe brings the
+//! guest down, fuzzer knows which interface did it, disables it and resumes
+//! from the next one after reboot.
+use crate::transfer;
+use core::gen::gen_seq;
+use core::prog::Prog;
+use core::target::Target;
+use fots::types::FnId;
+use serde::{Deserialize, Serialize};
+use std::io::{Read, Write};
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub enum ProbeMsg {
+    /// Interface is being probed, it's to blame if no End comes.
+    Begin(FnId),
+    /// Interface is probed, true if it should be disabled.
+    End(FnId, bool),
+    /// All interfaces are probed.
+    Finish,
+}
+
+/// Probe interfaces not in probed(sorted), report each of them to conn.
+pub fn probe<T: Read + Write>(t: &Target, conn: &mut T) -> Result<(), transfer::Error> {
+    let probed: Vec<FnId> = transfer::recv(conn)?;
+    let conf = Default::default();
+    for g in t.iter_group() {
+        for (i, f) in g.iter_fn().enumerate() {
+            if probed.binary_search(&f.id).is_ok() {
+                continue;
+            }
+            transfer::send(&ProbeMsg::Begin(f.id), conn)?;
+            let p = gen_seq(&[i], g.id, t, &conf);
+            let disabled = !probe_prog(&p, t);
+            transfer::send(&ProbeMsg::End(f.id, disabled), conn)?;
+        }
+    }
+    transfer::send(&ProbeMsg::Finish, conn)
+}
+
+#[cfg(feature = "jit")]
+fn probe_prog(p: &Prog, t: &Target) -> bool {
+    use crate::exec::jit::{new_tcc, prepare_env};
+    use crate::exec::{kill_and_wait, wait_child};
+    use core::c::{to_probe_prog, PROBE_ENOSYS};
+    use nix::sys::wait::WaitStatus;
+    use nix::unistd::{fork, ForkResult};
+    use std::ffi::CString;
+    use std::os::raw::c_int;
+    use std::process::exit;
+    use std::time::Duration;
+    use tcc::Guard;
+
+    prepare_env();
+    let p = CString::new(to_probe_prog(p, t).as_bytes()).unwrap();
+    let sym = CString::new("main").unwrap();
+
+    let mut g = Guard::new().unwrap();
+    let mut cc = new_tcc(&mut g);
+    if cc.compile_string(&p).is_err() {
+        return false;
+    }
+    let mut p = match cc.relocate() {
+        Ok(p) => p,
+        Err(_) => return false,
+    };
+    let execute: fn() -> c_int = unsafe {
+        let symbol = p.get_symbol(&sym).unwrap();
+        std::mem::transmute(symbol)
+    };
+
+    match fork() {
+        Ok(ForkResult::Child) => {
+            use gag::Gag;
+            let _stdout = Gag::stdout().unwrap();
+            let _stderr = Gag::stderr().unwrap();
+            exit(execute())
+        }
+        Ok(ForkResult::Parent { child }) => {
+            const WAIT_TIME: Duration = Duration::from_secs(1);
+
+            match wait_child(child, WAIT_TIME) {
+                Some(WaitStatus::Exited(_, code)) => code != PROBE_ENOSYS,
+                // Killed by signal, syscall exists anyway.
+                Some(_) => true,
+                // Blocked or stopped call is implemented.
+                None => {
+                    kill_and_wait(child);
+                    true
+                }
+            }
+        }
+        Err(e) => exits!(exitcode::OSERR, "Fail to fork: {}", e),
+    }
+}
+
+#[cfg(not(feature = "jit"))]
+fn probe_prog(_p: &Prog, _t: &Target) -> bool {
+    true
+}
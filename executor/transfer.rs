@@ -1,8 +1,10 @@
 //! A implementation of very sample object transfer protocal.
 
-use crate::ExecResult;
-use bytes::BytesMut;
+use crate::{ExecResult, ExecTimes};
+use core::encode::{decode_prog, encode_prog, DecodeError};
 use core::prog::Prog;
+use core::target::Target;
+use serde::de::DeserializeOwned;
 use serde::{Deserialize, Serialize};
 use std::io;
 use std::io::{Read, Write};
@@ -19,40 +21,61 @@ pub enum Error {
     Io(#[from] io::Error),
     #[error("Serialize: {0}")]
     Serialize(#[from] bincode::Error),
+    #[error("Decode: {0}")]
+    Decode(#[from] DecodeError),
 }
 
-pub fn recv_prog<S: Read>(src: &mut S) -> Result<Prog, Error> {
-    let header = Header::default();
-    let headler_len = bincode::serialized_size(&header)? as usize;
+/// Size of encoded Header.
+const HEADER_LEN: usize = std::mem::size_of::<u32>();
 
-    let mut header_buf = BytesMut::with_capacity(headler_len);
-    assert!(header_buf.capacity() >= headler_len);
-    unsafe {
-        header_buf.set_len(headler_len);
-    }
+/// Recv prog sent by async_send_prog.
+pub fn recv_prog<S: Read>(src: &mut S, t: &Target) -> Result<Prog, Error> {
+    recv_prog_with(src, t, &mut Vec::new())
+}
+
+/// Recv prog with buf reused by each recv, prog is decoded from buf directly.
+pub fn recv_prog_with<S: Read>(src: &mut S, t: &Target, buf: &mut Vec<u8>) -> Result<Prog, Error> {
+    read_msg(src, buf)?;
+    decode_prog(buf, t).map_err(|e| e.into())
+}
+
+/// Read body of one message to buf, buf only grows when a longer message comes.
+fn read_msg<S: Read>(src: &mut S, buf: &mut Vec<u8>) -> Result<(), Error> {
+    let mut header_buf = [0; HEADER_LEN];
     src.read_exact(&mut header_buf)?;
     let header: Header = bincode::deserialize(&header_buf)?;
 
-    let body_len = header.len as usize;
-    let mut body_buf = BytesMut::with_capacity(body_len);
-    unsafe {
-        body_buf.set_len(body_len);
-    }
-    src.read_exact(&mut body_buf)?;
+    buf.clear();
+    buf.resize(header.len as usize, 0);
+    src.read_exact(buf)?;
+    Ok(())
+}
 
-    bincode::deserialize(&body_buf).map_err(|e| e.into())
+pub fn recv<T: DeserializeOwned, S: Read>(src: &mut S) -> Result<T, Error> {
+    let mut buf = Vec::new();
+    read_msg(src, &mut buf)?;
+    bincode::deserialize(&buf).map_err(|e| e.into())
 }
 
 pub fn send<T: Serialize, S: Write>(v: &T, out: &mut S) -> Result<(), Error> {
+    send_with(v, out, &mut Vec::new())
+}
+
+/// Send v with buf reused by each send, header and body are written at once.
+pub fn send_with<T: Serialize, S: Write>(
+    v: &T,
+    out: &mut S,
+    buf: &mut Vec<u8>,
+) -> Result<(), Error> {
     let len = bincode::serialized_size(v)? as u32;
     let header = Header { len };
 
-    let header = bincode::serialize(&header)?;
-    let body = bincode::serialize(v)?;
-
-    out.write_all(&header)?;
-    out.write_all(&body)?;
+    buf.clear();
+    buf.reserve(HEADER_LEN + len as usize);
+    bincode::serialize_into(&mut *buf, &header)?;
+    bincode::serialize_into(&mut *buf, v)?;
 
+    out.write_all(buf)?;
     Ok(())
 }
 
@@ -70,23 +93,49 @@ pub async fn async_send<T: Serialize, S: AsyncWrite + Unpin>(
     Ok(())
 }
 
-pub async fn async_recv_result<T: AsyncRead + Unpin>(src: &mut T) -> Result<ExecResult, Error> {
-    let header = Header::default();
-    let headler_len = bincode::serialized_size(&header)? as usize;
-    let mut header_buf = BytesMut::with_capacity(headler_len);
-    assert!(header_buf.capacity() >= headler_len);
-    unsafe {
-        header_buf.set_len(headler_len);
-    }
+/// Send p with compact encoding, buf is reused by each send. Header is written in
+/// front of encoded prog, so the whole message is encoded in one pass.
+pub async fn async_send_prog<S: AsyncWrite + Unpin>(
+    p: &Prog,
+    t: &Target,
+    buf: &mut Vec<u8>,
+    out: &mut S,
+) -> Result<(), Error> {
+    buf.clear();
+    buf.extend_from_slice(&[0; HEADER_LEN]);
+    encode_prog(p, t, buf);
+    // same as bincode encoded Header
+    let len = (buf.len() - HEADER_LEN) as u32;
+    buf[..HEADER_LEN].copy_from_slice(&len.to_le_bytes());
+
+    out.write_all(buf).await?;
+    Ok(())
+}
+
+/// Recv exec result and its timings with buf reused by each recv.
+pub async fn async_recv_result<T: AsyncRead + Unpin>(
+    src: &mut T,
+    buf: &mut Vec<u8>,
+) -> Result<(ExecResult, ExecTimes), Error> {
+    async_read_msg(src, buf).await?;
+    bincode::deserialize(buf).map_err(|e| e.into())
+}
+
+pub async fn async_recv<V: DeserializeOwned, T: AsyncRead + Unpin>(
+    src: &mut T,
+) -> Result<V, Error> {
+    let mut buf = Vec::new();
+    async_read_msg(src, &mut buf).await?;
+    bincode::deserialize(&buf).map_err(|e| e.into())
+}
+
+async fn async_read_msg<T: AsyncRead + Unpin>(src: &mut T, buf: &mut Vec<u8>) -> Result<(), Error> {
+    let mut header_buf = [0; HEADER_LEN];
     src.read_exact(&mut header_buf).await?;
     let header: Header = bincode::deserialize(&header_buf)?;
 
-    let body_len = header.len as usize;
-    let mut body_buf = BytesMut::with_capacity(body_len);
-    unsafe {
-        body_buf.set_len(body_len);
-    }
-    src.read_exact(&mut body_buf).await?;
-
-    bincode::deserialize(&body_buf).map_err(|e| e.into())
+    buf.clear();
+    buf.resize(header.len as usize, 0);
+    src.read_exact(buf).await?;
+    Ok(())
 }
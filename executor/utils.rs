@@ -14,8 +14,9 @@ pub use evt::*;
 
 #[cfg(target_os = "linux")]
 pub mod evt {
+    use nix::libc;
     use nix::sys::eventfd::{eventfd, EfdFlags};
-    use nix::unistd::{close, read, write};
+    use nix::unistd::{close, read, write, Pid};
     use std::os::unix::io::{AsRawFd, RawFd};
     use std::rc::Rc;
 
@@ -90,4 +91,39 @@ pub mod evt {
             *self.fd
         }
     }
+
+    /// Fd referring to a child process, it becomes readable once the child exits,
+    /// so exit of childs can be polled together with other fds.
+    pub struct PidFd {
+        fd: RawFd,
+        pub pid: Pid,
+    }
+
+    /// Open pid fd of pid, None if kernel doesn't support pidfd_open(before 5.3).
+    pub fn pidfd(pid: Pid) -> Option<PidFd> {
+        let fd = unsafe { libc::syscall(libc::SYS_pidfd_open, pid.as_raw(), 0) };
+        if fd < 0 {
+            None
+        } else {
+            Some(PidFd {
+                fd: fd as RawFd,
+                pid,
+            })
+        }
+    }
+
+    impl Drop for PidFd {
+        /// Failing to close only leaks the fd, not worth killing the executor.
+        fn drop(&mut self) {
+            if let Err(e) = close(self.fd) {
+                eprintln!("Fail to close pid fd {}: {}", self.fd, e);
+            }
+        }
+    }
+
+    impl AsRawFd for PidFd {
+        fn as_raw_fd(&self) -> RawFd {
+            self.fd
+        }
+    }
 }
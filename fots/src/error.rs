@@ -8,6 +8,8 @@ pub enum Error {
     Parse(#[from] pest::error::Error<Rule>),
     #[error("Unresolved symbols:{0:?}")]
     Ident(Vec<String>),
+    #[error("Rules calling fns of different groups:{0:?}")]
+    CrossGroup(Vec<String>),
 }
 
 impl Error {
@@ -11,7 +11,7 @@ use crate::error;
 use crate::parse::Rule;
 use crate::types::{
     Attr, Field, Flag, FnId, FnInfo, Group, GroupId, Items, NumInfo, NumLimit, Param, PtrDir,
-    StrType, Type, TypeId, TypeInfo, DEFAULT_GID,
+    RuleExp, RuleInfo, StrType, TplArg, TplCall, Type, TypeId, TypeInfo, DEFAULT_GID,
 };
 use crate::{num, parse_grammar};
 
@@ -26,6 +26,8 @@ struct Parser {
     type_table: TypeTable,
     group_table: GroupTable,
     fid_count: FnId,
+    /// Rules whose calls are resolved in finish.
+    rules: Vec<RuleInfo>,
 }
 
 impl Parser {
@@ -34,6 +36,7 @@ impl Parser {
             type_table: TypeTable::with_primitives(),
             group_table: Default::default(),
             fid_count: 0,
+            rules: Vec::new(),
         }
     }
 
@@ -60,11 +63,15 @@ impl Parser {
         }
 
         self.group_table.groups.retain(|_, g| g.fn_num() != 0);
+        let rules = Self::resolve_rules(
+            &self.group_table,
+            std::mem::replace(&mut self.rules, Vec::new()),
+        )?;
 
         let mut items = Items {
             types: self.type_table.into_types(),
             groups: self.group_table.into_groups(),
-            rules: Vec::new(),
+            rules,
         };
         items.types.sort_by_key(|a| a.tid);
         items.groups.sort_by_key(|i| i.id);
@@ -157,8 +164,155 @@ impl Parser {
         self.group_table.add_fns(gid, fns);
     }
 
-    fn parse_rule(&mut self, _p: Pair<Rule>) {
-        todo!("Parsing rule")
+    fn parse_rule(&mut self, p: Pair<Rule>) {
+        let mut p = p.into_inner();
+        let ident = p.next().unwrap().as_str().to_string();
+        let mut binds = Vec::new();
+        let mut exp = None;
+        for p in p.next().unwrap().into_inner() {
+            match p.as_rule() {
+                Rule::RTplCall => {
+                    let mut p = p.into_inner();
+                    let ident = p.next().unwrap().as_str().to_string();
+                    binds.push((ident, self.parse_tpl_call(p.next().unwrap())));
+                }
+                Rule::ItemExp => exp = Some(self.parse_item_exp(p)),
+                _ => unreachable!(),
+            }
+        }
+        self.rules.push(RuleInfo {
+            ident,
+            binds,
+            exp: exp.unwrap(),
+        });
+    }
+
+    fn parse_item_exp(&mut self, p: Pair<Rule>) -> RuleExp {
+        let mut exps = p
+            .into_inner()
+            .map(|p| {
+                let mut choices = p
+                    .into_inner()
+                    .map(|p| self.parse_factor(p))
+                    .collect::<Vec<_>>();
+                if choices.len() == 1 {
+                    choices.pop().unwrap()
+                } else {
+                    RuleExp::Choice(choices)
+                }
+            })
+            .collect::<Vec<_>>();
+        if exps.len() == 1 {
+            exps.pop().unwrap()
+        } else {
+            RuleExp::Seq(exps)
+        }
+    }
+
+    fn parse_factor(&mut self, p: Pair<Rule>) -> RuleExp {
+        let mut p = p.into_inner();
+        let inner = p.next().unwrap();
+        match inner.as_rule() {
+            Rule::TplCall => RuleExp::Call(self.parse_tpl_call(inner)),
+            Rule::ItemExp => {
+                let exp = self.parse_item_exp(inner);
+                match p.next().map(|p| p.as_rule()) {
+                    Some(Rule::Repeat) => RuleExp::Repeat(Box::new(exp)),
+                    None => exp,
+                    _ => unreachable!(),
+                }
+            }
+            _ => unreachable!(),
+        }
+    }
+
+    fn parse_tpl_call(&mut self, p: Pair<Rule>) -> TplCall {
+        let mut p = p.into_inner();
+        let dec_name = p.next().unwrap().as_str().to_string();
+        let args = p
+            .map(|p| {
+                let p = p.into_inner().next().unwrap();
+                match p.as_rule() {
+                    Rule::PlaceHolder => TplArg::Any,
+                    Rule::Ident => TplArg::Ref(p.as_str().to_string()),
+                    Rule::StringLiteral => TplArg::Str(self.parse_str_literal(p)),
+                    Rule::NumLiteral => TplArg::Num(self.parse_num(p)),
+                    _ => unreachable!(),
+                }
+            })
+            .collect();
+        TplCall {
+            // resolved in finish
+            fid: FnId::max_value(),
+            dec_name,
+            args,
+        }
+    }
+
+    /// Resolve calls of rules to declared fns, names of unknown fns or bindings are errors.
+    /// A rule only expands within prog of a group, so it is bound to every group
+    /// declaring all of its calls, one copy per group in order of group id. Rules
+    /// no group can hold are errors.
+    fn resolve_rules(
+        group_table: &GroupTable,
+        rules: Vec<RuleInfo>,
+    ) -> Result<Vec<RuleInfo>, error::Error> {
+        let mut groups = group_table.groups.values().collect::<Vec<_>>();
+        groups.sort_by_key(|g| g.id);
+        let fids = groups
+            .iter()
+            .map(|g| {
+                g.iter_fn()
+                    .map(|f| (f.dec_name.clone(), f.id))
+                    .collect::<HashMap<_, _>>()
+            })
+            .collect::<Vec<_>>();
+        let mut unresolved = Vec::new();
+        let mut cross_group = Vec::new();
+        let mut resolved = Vec::new();
+        for r in rules {
+            let binds = r.binds.iter().map(|(i, _)| i).collect::<Vec<_>>();
+            let len = unresolved.len();
+            for c in r.iter_call() {
+                if !fids.iter().any(|fids| fids.contains_key(&c.dec_name)) {
+                    unresolved.push(c.dec_name.clone());
+                }
+                for a in c.args.iter() {
+                    if let TplArg::Ref(ident) = a {
+                        if !binds.contains(&ident) {
+                            unresolved.push(ident.clone());
+                        }
+                    }
+                }
+            }
+            if unresolved.len() != len {
+                continue;
+            }
+
+            let owners = fids
+                .iter()
+                .filter(|fids| r.iter_call().all(|c| fids.contains_key(&c.dec_name)))
+                .collect::<Vec<_>>();
+            if owners.is_empty() {
+                cross_group.push(r.ident.clone());
+            }
+            for fids in owners {
+                let mut r = r.clone();
+                let mut resolve = |c: &mut TplCall| c.fid = fids[&c.dec_name];
+                for (_, c) in r.binds.iter_mut() {
+                    resolve(c);
+                }
+                r.exp.for_each_call_mut(&mut resolve);
+                resolved.push(r);
+            }
+        }
+        if !unresolved.is_empty() {
+            Err(error::Error::with_idents(unresolved))
+        } else if !cross_group.is_empty() {
+            Err(error::Error::CrossGroup(cross_group))
+        } else {
+            Ok(resolved)
+        }
     }
 
     fn parse_type(&mut self, p: Pair<Rule>) -> TypeId {
@@ -618,3 +772,71 @@ impl TypeTable {
             .collect()
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use crate::error::Error;
+    use crate::items::parse;
+    use std::collections::HashMap;
+
+    const GROUPS: &str = r#"
+type fd = res<i32>
+group A {
+    fn open(f *filename) fd
+    fn lseek(f fd, offset usize)
+}
+group B {
+    fn open(f *filename) fd
+    fn lseek(f fd, offset usize)
+    fn read(f fd, buf *Out [i8])
+}
+group C {
+    fn read(f fd, buf *Out [i8])
+}
+"#;
+
+    #[test]
+    fn rule_in_groups() {
+        let text = format!("{}\nrule seek {{ f = open(@) (lseek(f, @))* }}", GROUPS);
+        let items = parse(&text).unwrap();
+        let gids = items
+            .groups
+            .iter()
+            .flat_map(|g| g.iter_fn().map(move |f| (f.id, g.id)))
+            .collect::<HashMap<_, _>>();
+        let ident = |gid| {
+            items
+                .groups
+                .iter()
+                .find(|g| g.id == gid)
+                .unwrap()
+                .ident
+                .as_str()
+        };
+
+        // one copy for each group declaring all calls, in order of group id
+        let owners = items
+            .rules
+            .iter()
+            .map(|r| {
+                let gid = gids[&r.iter_call().next().unwrap().fid];
+                assert!(r.iter_call().all(|c| gids[&c.fid] == gid));
+                ident(gid)
+            })
+            .collect::<Vec<_>>();
+        assert_eq!(owners, vec!["A", "B"]);
+        assert_eq!(parse(&text).unwrap().rules, items.rules);
+    }
+
+    #[test]
+    fn rule_across_groups() {
+        let text = format!(
+            "{}\nrule bad {{ f = open(@) read(f, @) lseek(f, @) }}",
+            GROUPS.replace("    fn read(f fd, buf *Out [i8])\n}\ngroup C", "}\ngroup C")
+        );
+        match parse(&text) {
+            Err(Error::CrossGroup(rules)) => assert_eq!(rules, vec!["bad".to_string()]),
+            r => panic!("unexpected result: {:?}", r.map(|i| i.rules)),
+        }
+    }
+}
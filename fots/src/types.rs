@@ -14,7 +14,7 @@ use crate::parse::Rule;
 pub struct Items {
     pub types: Vec<Type>,
     pub groups: Vec<Group>,
-    pub rules: Vec<RuleInfo>, // not used yet
+    pub rules: Vec<RuleInfo>,
 }
 
 impl Display for Items {
@@ -59,7 +59,21 @@ impl Display for Items {
             fn_table
         );
 
-        write!(f, "{}{}{}{}", stat_info, type_info, group_info, fn_info)
+        let mut rule_table = Table::new();
+        rule_table.add_row(row!["name", "rule"]);
+        for r in self.rules.iter() {
+            rule_table.add_row(row![r.ident, r]);
+        }
+        let rule_info = format!(
+            "\n\t=====================RULE=====================\n{}",
+            rule_table
+        );
+
+        write!(
+            f,
+            "{}{}{}{}{}",
+            stat_info, type_info, group_info, fn_info, rule_info
+        )
     }
 }
 
@@ -73,14 +87,123 @@ impl Items {
     }
 }
 
-/// Not sure if rule def is useful for program generation, so it's
-/// not implemented yet.
+/// Rule of calling interfaces
+///
+/// Rule describes calls that should be made before or together with an
+/// interface, e.g. `rule rw { fd = open("./file", @, @) (read(fd, @, @) | write(fd, @, @))* }`.
+/// Bindings are made first and can be referenced by name, exp is made next.
 #[derive(Debug, Clone, PartialEq, Eq, Hash, Deserialize, Serialize)]
-pub struct RuleInfo;
+pub struct RuleInfo {
+    pub ident: String,
+    /// Named calls, return value of each one can be referenced by following calls.
+    pub binds: Vec<(String, TplCall)>,
+    pub exp: RuleExp,
+}
+
+impl RuleInfo {
+    /// Iterate every call of rule.
+    pub fn iter_call(&self) -> impl Iterator<Item = &TplCall> + '_ {
+        let mut calls = Vec::new();
+        self.exp.collect_calls(&mut calls);
+        self.binds.iter().map(|(_, c)| c).chain(calls.into_iter())
+    }
+}
 
 impl Display for RuleInfo {
-    fn fmt(&self, _f: &mut Formatter<'_>) -> Result<(), Error> {
-        todo!()
+    fn fmt(&self, f: &mut Formatter<'_>) -> Result<(), Error> {
+        write!(f, "rule {}{{", self.ident)?;
+        for (ident, call) in self.binds.iter() {
+            write!(f, "{}={} ", ident, call)?;
+        }
+        write!(f, "{}}}", self.exp)
+    }
+}
+
+/// Call expression of rule.
+#[derive(Debug, Clone, PartialEq, Eq, Hash, Deserialize, Serialize)]
+pub enum RuleExp {
+    Call(TplCall),
+    /// Every sub exp in order.
+    Seq(Vec<RuleExp>),
+    /// One of sub exps.
+    Choice(Vec<RuleExp>),
+    /// Sub exp, zero or more times.
+    Repeat(Box<RuleExp>),
+}
+
+impl RuleExp {
+    pub fn for_each_call_mut<F: FnMut(&mut TplCall)>(&mut self, f: &mut F) {
+        match self {
+            RuleExp::Call(c) => f(c),
+            RuleExp::Seq(exps) | RuleExp::Choice(exps) => {
+                exps.iter_mut().for_each(|e| e.for_each_call_mut(f))
+            }
+            RuleExp::Repeat(e) => e.for_each_call_mut(f),
+        }
+    }
+
+    fn collect_calls<'a>(&'a self, calls: &mut Vec<&'a TplCall>) {
+        match self {
+            RuleExp::Call(c) => calls.push(c),
+            RuleExp::Seq(exps) | RuleExp::Choice(exps) => {
+                exps.iter().for_each(|e| e.collect_calls(calls))
+            }
+            RuleExp::Repeat(e) => e.collect_calls(calls),
+        }
+    }
+}
+
+impl Display for RuleExp {
+    fn fmt(&self, f: &mut Formatter<'_>) -> Result<(), Error> {
+        match self {
+            RuleExp::Call(c) => write!(f, "{}", c),
+            RuleExp::Seq(exps) => {
+                let exps = exps.iter().map(|e| e.to_string()).collect::<Vec<_>>();
+                write!(f, "{}", exps.join(" "))
+            }
+            RuleExp::Choice(exps) => {
+                let exps = exps.iter().map(|e| e.to_string()).collect::<Vec<_>>();
+                write!(f, "{}", exps.join("|"))
+            }
+            RuleExp::Repeat(e) => write!(f, "({})*", e),
+        }
+    }
+}
+
+/// Call with constrained args in rule.
+#[derive(Debug, Clone, PartialEq, Eq, Hash, Deserialize, Serialize)]
+pub struct TplCall {
+    pub fid: FnId,
+    pub dec_name: String,
+    pub args: Vec<TplArg>,
+}
+
+impl Display for TplCall {
+    fn fmt(&self, f: &mut Formatter<'_>) -> Result<(), Error> {
+        let args = self.args.iter().map(|a| a.to_string()).collect::<Vec<_>>();
+        write!(f, "{}({})", self.dec_name, args.join(","))
+    }
+}
+
+/// Arg of call in rule.
+#[derive(Debug, Clone, PartialEq, Eq, Hash, Deserialize, Serialize)]
+pub enum TplArg {
+    /// `@`, generated as usual.
+    Any,
+    /// Return value of named call.
+    Ref(String),
+    Str(String),
+    Num(i64),
+}
+
+impl Display for TplArg {
+    fn fmt(&self, f: &mut Formatter<'_>) -> Result<(), Error> {
+        match self {
+            TplArg::Any => write!(f, "@"),
+            TplArg::Ref(ident) => write!(f, "{}", ident),
+            TplArg::Str(s) => write!(f, "{:?}", s),
+            TplArg::Num(n) => write!(f, "{}", n),
+        }
     }
 }
 
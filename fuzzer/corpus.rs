@@ -1,48 +1,442 @@
+use crate::directed::{self, UNREACHABLE};
+use crate::feedback::FeedBack;
+use core::mutate::SeedPool;
 use core::prog::Prog;
-use std::collections::HashSet;
-use std::iter::FromIterator;
+use fots::types::{FnId, GroupId};
+use rand::seq::SliceRandom;
+use rand::{thread_rng, Rng};
+use std::collections::hash_map::DefaultHasher;
+use std::collections::{HashMap, HashSet};
+use std::hash::{Hash, Hasher};
 use tokio::sync::Mutex;
 
+/// Number of progs competing in each seed selection.
+const TOURNAMENT_SIZE: usize = 4;
+/// Energy of prog whose blocks are unknown, e.g. loaded from last run.
+const DEFAULT_ENERGY: f64 = 1.0;
+/// Magic of corpus log, a corpus file without it is a plain list of progs.
+const LOG_MAGIC: &[u8] = b"HCORPUS\x01";
+/// Corpus log is rewritten once it holds this many entries per live prog.
+const COMPACT_RATIO: usize = 2;
+
 #[derive(Debug, Default)]
 pub struct Corpus {
-    pub inner: Mutex<HashSet<Prog>>,
+    pub inner: Mutex<CorpusInner>,
+}
+
+#[derive(Debug, Default)]
+pub struct CorpusInner {
+    pub progs: Vec<Prog>,
+    /// Hit counter slots of rarest blocks each prog covers, see `FeedBack::rarest`.
+    slots: Vec<Box<[u32]>>,
+    /// Distance to targets of directed fuzzing covered by each prog.
+    dists: Vec<u32>,
+    /// Hash of prog to indexes of progs with that hash, progs are compared on match
+    /// since different progs may share one.
+    index: HashMap<u64, Vec<usize>>,
+    /// Indexes of progs of each group.
+    by_group: HashMap<GroupId, Vec<usize>>,
+    /// Indexes of progs containing each call, one entry per prog.
+    by_fn: HashMap<FnId, Vec<usize>>,
+    /// Changes since last dump, only kept once a full log is dumped.
+    journal: Vec<LogEntry>,
+    /// Entries of corpus log dumped by this run, None before first dump.
+    logged: Option<usize>,
+}
+
+/// Entry of corpus log, entries are replayed in order at startup.
+#[derive(Debug, Serialize, Deserialize)]
+enum LogEntry {
+    Insert(Prog),
+    Remove(Prog),
+}
+
+/// Dumped corpus log.
+pub enum Dump {
+    /// Whole log, replaces corpus file.
+    Full(Vec<u8>),
+    /// Entries to append to the log dumped before.
+    Append(Vec<u8>),
 }
 
 impl Corpus {
-    pub async fn insert(&self, p: Prog) -> bool {
+    /// Insert prog with slots of its rarest blocks and its distance to targets,
+    /// slots of existing prog are refreshed.
+    pub async fn insert(&self, p: Prog, slots: Vec<u32>, dist: u32) -> bool {
+        let mut inner = self.inner.lock().await;
+        inner.insert(p, slots, dist)
+    }
+
+    /// Replace prog old with simplified one with the same calls and slots of its
+    /// rarest blocks, false if old is not in corpus or new one is already in.
+    pub async fn replace(&self, old: &Prog, new: Prog, slots: Vec<u32>) -> bool {
+        let mut inner = self.inner.lock().await;
+        inner.replace(old, new, slots)
+    }
+
+    /// Remove prog p, false if it is not in corpus.
+    pub async fn remove(&self, p: &Prog) -> bool {
         let mut inner = self.inner.lock().await;
-        inner.insert(p)
+        inner.remove(p)
     }
 
     pub async fn len(&self) -> usize {
         let inner = self.inner.lock().await;
-        inner.len()
+        inner.progs.len()
     }
 
     pub async fn is_empty(&self) -> bool {
         let inner = self.inner.lock().await;
-        inner.is_empty()
+        inner.progs.is_empty()
     }
 
-    pub async fn dump(&self) -> bincode::Result<Vec<u8>> {
-        let inner = self.inner.lock().await;
-        let mut progs = inner
+    /// Dump corpus as a log of inserted and removed progs. Only changes since last
+    /// dump are encoded, unless it's the first dump or removed progs take too much
+    /// of the log. Lock is only held while progs or changes are taken.
+    pub async fn dump(&self) -> bincode::Result<Option<Dump>> {
+        let (full, entries) = {
+            let mut inner = self.inner.lock().await;
+            let live = inner.progs.len();
+            match inner.logged {
+                Some(n) if n + inner.journal.len() <= COMPACT_RATIO * live => {
+                    if inner.journal.is_empty() {
+                        return Ok(None);
+                    }
+                    inner.logged = Some(n + inner.journal.len());
+                    let entries = std::mem::replace(&mut inner.journal, Vec::new());
+                    (None, entries)
+                }
+                _ => {
+                    inner.logged = Some(live);
+                    inner.journal.clear();
+                    (Some(inner.progs.clone()), Vec::new())
+                }
+            }
+        };
+
+        if let Some(progs) = full {
+            let mut buf = LOG_MAGIC.to_vec();
+            for p in progs {
+                put_entry(&mut buf, LogEntry::Insert(p))?;
+            }
+            Ok(Some(Dump::Full(buf)))
+        } else {
+            let mut buf = Vec::new();
+            for e in entries {
+                put_entry(&mut buf, e)?;
+            }
+            Ok(Some(Dump::Append(buf)))
+        }
+    }
+
+    /// Progs of corpus file, either a corpus log or a plain list of progs. A torn
+    /// entry at the end of log, left by an interrupted append, is skipped.
+    pub fn load(mut data: &[u8]) -> bincode::Result<Vec<Prog>> {
+        if !data.starts_with(LOG_MAGIC) {
+            return bincode::deserialize(data);
+        }
+        data = &data[LOG_MAGIC.len()..];
+        let mut inner = CorpusInner::default();
+        while !data.is_empty() {
+            let entry = if data.len() >= 4 {
+                let mut len = [0; 4];
+                len.copy_from_slice(&data[..4]);
+                data.get(4..4 + u32::from_le_bytes(len) as usize)
+            } else {
+                None
+            };
+            let entry = match entry {
+                Some(entry) => entry,
+                None => {
+                    warn!("Corpus: torn entry at end of log skipped");
+                    break;
+                }
+            };
+            data = &data[4 + entry.len()..];
+            match bincode::deserialize(entry)? {
+                LogEntry::Insert(p) => {
+                    inner.insert(p, Vec::new(), UNREACHABLE);
+                }
+                LogEntry::Remove(p) => {
+                    inner.remove(&p);
+                }
+            }
+        }
+        Ok(inner.progs)
+    }
+}
+
+impl CorpusInner {
+    fn insert(&mut self, p: Prog, slots: Vec<u32>, dist: u32) -> bool {
+        if let Some(i) = self.find(&p) {
+            if !slots.is_empty() {
+                self.slots[i] = slots.into_boxed_slice();
+            }
+            self.dists[i] = self.dists[i].min(dist);
+            false
+        } else {
+            let i = self.progs.len();
+            self.log(|| LogEntry::Insert(p.clone()));
+            self.index.entry(digest(&p)).or_default().push(i);
+            self.by_group.entry(p.gid).or_default().push(i);
+            for c in &p.calls {
+                let progs = self.by_fn.entry(c.fid).or_default();
+                if progs.last() != Some(&i) {
+                    progs.push(i);
+                }
+            }
+            self.progs.push(p);
+            self.slots.push(slots.into_boxed_slice());
+            self.dists.push(dist);
+            true
+        }
+    }
+
+    fn replace(&mut self, old: &Prog, new: Prog, slots: Vec<u32>) -> bool {
+        debug_assert!(old
+            .calls
             .iter()
-            .map(|p| {
-                let mut p = p.clone();
-                p.shrink();
-                p
-            })
-            .collect::<Vec<_>>();
-        progs.shrink_to_fit();
-        bincode::serialize(&progs)
-    }
-
-    pub fn load(c: &[u8]) -> bincode::Result<Self> {
-        let mut progs: Vec<Prog> = bincode::deserialize(c)?;
-        progs.shrink_to_fit();
-        Ok(Self {
-            inner: Mutex::new(HashSet::from_iter(progs)),
-        })
+            .map(|c| c.fid)
+            .eq(new.calls.iter().map(|c| c.fid)));
+
+        if self.find(&new).is_some() {
+            return false;
+        }
+        if let Some(i) = self.find(old) {
+            // Calls are the same, so indexes of group and fns are still valid.
+            self.log(|| LogEntry::Remove(old.clone()));
+            self.log(|| LogEntry::Insert(new.clone()));
+            self.unindex(digest(old), i);
+            self.index.entry(digest(&new)).or_default().push(i);
+            self.progs[i] = new;
+            self.slots[i] = slots.into_boxed_slice();
+            true
+        } else {
+            false
+        }
+    }
+
+    /// Remove prog p, last prog is moved to its index.
+    fn remove(&mut self, p: &Prog) -> bool {
+        let i = match self.find(p) {
+            Some(i) => i,
+            None => return false,
+        };
+        self.log(|| LogEntry::Remove(p.clone()));
+        self.unindex(digest(p), i);
+        let last = self.progs.len() - 1;
+        unlink(self.by_group.get_mut(&p.gid).unwrap(), i);
+        for fid in fids_of(p) {
+            unlink(self.by_fn.get_mut(&fid).unwrap(), i);
+        }
+        if i != last {
+            let moved = &self.progs[last];
+            relink(self.index.get_mut(&digest(moved)).unwrap(), last, i);
+            relink(self.by_group.get_mut(&moved.gid).unwrap(), last, i);
+            for fid in fids_of(moved) {
+                relink(self.by_fn.get_mut(&fid).unwrap(), last, i);
+            }
+        }
+        self.progs.swap_remove(i);
+        self.slots.swap_remove(i);
+        self.dists.swap_remove(i);
+        true
+    }
+
+    /// Record change for next dump, changes before first dump are in it anyway.
+    fn log<F: FnOnce() -> LogEntry>(&mut self, entry: F) {
+        if self.logged.is_some() {
+            self.journal.push(entry());
+        }
+    }
+
+    fn find(&self, p: &Prog) -> Option<usize> {
+        self.index
+            .get(&digest(p))
+            .and_then(|idx| idx.iter().find(|&&i| self.progs[i] == *p))
+            .copied()
+    }
+
+    fn unindex(&mut self, h: u64, i: usize) {
+        let idx = self.index.get_mut(&h).unwrap();
+        unlink(idx, i);
+        if idx.is_empty() {
+            self.index.remove(&h);
+        }
+    }
+
+    /// Choose index of seed prog, progs covering rarely hit blocks have more energy
+    /// and win more often. Energy is computed with current hit counts, so seeds
+    /// whose blocks become hot lose their priority over time. Seeds close to targets
+    /// of directed fuzzing have more energy too.
+    pub fn select(&self, feedback: &FeedBack) -> usize {
+        assert!(!self.progs.is_empty());
+
+        let mut rng = thread_rng();
+        let mut best = rng.gen_range(0, self.progs.len());
+        let mut best_energy = self.energy(best, feedback);
+        for _ in 1..TOURNAMENT_SIZE {
+            let i = rng.gen_range(0, self.progs.len());
+            let energy = self.energy(i, feedback);
+            if energy > best_energy {
+                best = i;
+                best_energy = energy;
+            }
+        }
+        best
+    }
+
+    fn energy(&self, i: usize, feedback: &FeedBack) -> f64 {
+        let energy = if self.slots[i].is_empty() {
+            DEFAULT_ENERGY
+        } else {
+            feedback.rarity(&self.slots[i])
+        };
+        energy * directed::energy(self.dists[i])
+    }
+}
+
+impl SeedPool for CorpusInner {
+    fn choose_in_group(&self, gid: GroupId) -> Option<&Prog> {
+        self.by_group
+            .get(&gid)
+            .and_then(|progs| progs.choose(&mut thread_rng()))
+            .map(|&i| &self.progs[i])
+    }
+
+    fn choose_with_call(&self, fid: FnId) -> Option<&Prog> {
+        self.by_fn
+            .get(&fid)
+            .and_then(|progs| progs.choose(&mut thread_rng()))
+            .map(|&i| &self.progs[i])
+    }
+}
+
+impl From<Vec<Prog>> for Corpus {
+    fn from(progs: Vec<Prog>) -> Self {
+        let mut inner = CorpusInner::default();
+        for p in progs {
+            inner.insert(p, Vec::new(), UNREACHABLE);
+        }
+        inner.progs.shrink_to_fit();
+        inner.slots.shrink_to_fit();
+        inner.dists.shrink_to_fit();
+        Self {
+            inner: Mutex::new(inner),
+        }
+    }
+}
+
+/// Append length and encoding of entry to buf.
+fn put_entry(buf: &mut Vec<u8>, entry: LogEntry) -> bincode::Result<()> {
+    let data = bincode::serialize(&entry)?;
+    buf.extend_from_slice(&(data.len() as u32).to_le_bytes());
+    buf.extend_from_slice(&data);
+    Ok(())
+}
+
+/// Distinct calls of p.
+fn fids_of(p: &Prog) -> HashSet<FnId> {
+    p.calls.iter().map(|c| c.fid).collect()
+}
+
+fn unlink(idx: &mut Vec<usize>, i: usize) {
+    if let Some(pos) = idx.iter().position(|&j| j == i) {
+        idx.swap_remove(pos);
+    }
+}
+
+fn relink(idx: &mut Vec<usize>, from: usize, to: usize) {
+    if let Some(j) = idx.iter_mut().find(|j| **j == from) {
+        *j = to;
+    }
+}
+
+fn digest(p: &Prog) -> u64 {
+    let mut hasher = DefaultHasher::new();
+    p.hash(&mut hasher);
+    hasher.finish()
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::corpus::{Corpus, Dump};
+    use crate::directed::UNREACHABLE;
+    use core::prog::{Call, Prog};
+
+    fn prog(gid: usize, fids: &[usize]) -> Prog {
+        let mut p = Prog::new(gid);
+        for &fid in fids {
+            p.add_call(Call::new(fid));
+        }
+        p
+    }
+
+    fn sorted(mut progs: Vec<Prog>) -> Vec<Prog> {
+        progs.sort();
+        progs
+    }
+
+    #[tokio::test]
+    async fn log_round_trip() {
+        let corpus = Corpus::default();
+        let progs = vec![
+            prog(0, &[1]),
+            prog(0, &[1, 2]),
+            prog(0, &[2]),
+            prog(1, &[3]),
+        ];
+        for p in progs.iter() {
+            corpus.insert(p.clone(), Vec::new(), UNREACHABLE).await;
+        }
+        let mut log = match corpus.dump().await.unwrap() {
+            Some(Dump::Full(data)) => data,
+            _ => panic!("first dump should be full"),
+        };
+        assert!(corpus.dump().await.unwrap().is_none());
+
+        let inserted = prog(1, &[4]);
+        corpus
+            .insert(inserted.clone(), Vec::new(), UNREACHABLE)
+            .await;
+        let replaced = prog(1, &[1, 2]);
+        corpus.remove(&progs[0]).await;
+        corpus
+            .replace(&progs[1], replaced.clone(), Vec::new())
+            .await;
+        match corpus.dump().await.unwrap() {
+            Some(Dump::Append(data)) => log.extend(data),
+            _ => panic!("small change should be appended"),
+        }
+        let live = sorted(vec![
+            replaced.clone(),
+            progs[2].clone(),
+            progs[3].clone(),
+            inserted.clone(),
+        ]);
+        assert_eq!(sorted(Corpus::load(&log).unwrap()), live);
+
+        // Torn entry of interrupted append is skipped.
+        let mut torn = log.clone();
+        torn.extend_from_slice(&[16, 0, 0, 0, 1]);
+        assert_eq!(sorted(Corpus::load(&torn).unwrap()), live);
+
+        // Log holding too many entries per live prog is rewritten.
+        corpus.remove(&progs[2]).await;
+        let log = match corpus.dump().await.unwrap() {
+            Some(Dump::Full(data)) => data,
+            _ => panic!("log should be compacted"),
+        };
+        assert_eq!(
+            sorted(Corpus::load(&log).unwrap()),
+            sorted(vec![replaced, progs[3].clone(), inserted])
+        );
+    }
+
+    #[test]
+    fn load_plain() {
+        let progs = vec![prog(0, &[1]), prog(1, &[2, 3])];
+        let data = bincode::serialize(&progs).unwrap();
+        assert_eq!(Corpus::load(&data).unwrap(), progs);
     }
 }
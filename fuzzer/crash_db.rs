@@ -0,0 +1,197 @@
+//! Crash database
+//!
+//! Known crashes survive restarts, so they are not triaged and reproduced again
+//! by each run. Crashes are bucketed by title, the first oops line of console
+//! output with addresses and numbers masked. Every hit appends one json line to
+//! the database file, bucket ids, first/last seen time and hit counts are
+//! recovered by replaying the file at startup.
+use chrono::prelude::*;
+use chrono::DateTime;
+use regex::Regex;
+use std::collections::HashMap;
+use std::path::Path;
+use tokio::fs::{read, OpenOptions};
+use tokio::io::AsyncWriteExt;
+
+/// Append-only database of crash buckets.
+pub const CRASH_DB_PATH: &str = "./crash_db";
+
+lazy_static! {
+    /// Start of kernel reports, e.g. "BUG: KASAN: use-after-free in ...".
+    static ref TITLE: Regex = Regex::new(
+        r"^(BUG:|WARNING:|INFO:|UBSAN:|KASAN:|KCSAN:|KMSAN:|kernel BUG at|general protection fault|divide error|Kernel panic|unreferenced object|Unable to handle kernel)"
+    )
+    .unwrap();
+    /// Console prefix of each line, e.g. "[   12.345678][ T123] ".
+    static ref PREFIX: Regex = Regex::new(r"^(\[\s*\d+\.\d+\])?(\[\s*[TC]\d+\])?\s*").unwrap();
+    static ref OFFSET: Regex = Regex::new(r"\+0x[0-9a-fA-F]+/0x[0-9a-fA-F]+").unwrap();
+    static ref NUM: Regex = Regex::new(r"\b(0x[0-9a-fA-F]+|[0-9a-fA-F]{8,}|\d+)\b").unwrap();
+}
+
+#[derive(Debug, Clone)]
+pub struct Bucket {
+    pub id: usize,
+    pub title: String,
+    pub first_seen: DateTime<Local>,
+    pub last_seen: DateTime<Local>,
+    pub hits: usize,
+}
+
+/// One hit of a bucket, a line of database file.
+#[derive(Deserialize, Serialize)]
+struct Record {
+    title: String,
+    time: DateTime<Local>,
+}
+
+#[derive(Default)]
+pub struct CrashDb {
+    buckets: Vec<Bucket>,
+    /// Title to bucket id.
+    index: HashMap<String, usize>,
+}
+
+impl CrashDb {
+    /// Replay database file, a missing file is an empty database. Torn last line
+    /// of an interrupted append is skipped.
+    pub async fn load<P: AsRef<Path>>(path: P) -> Self {
+        let mut db = Self::default();
+        let data = match read(path.as_ref()).await {
+            Ok(data) => data,
+            Err(ref e) if e.kind() == tokio::io::ErrorKind::NotFound => return db,
+            Err(e) => exits!(
+                exitcode::IOERR,
+                "Fail to read crash db {}: {}",
+                path.as_ref().display(),
+                e
+            ),
+        };
+        for l in String::from_utf8_lossy(&data).lines() {
+            match serde_json::from_str::<Record>(l) {
+                Ok(r) => {
+                    db.hit(r.title, r.time);
+                }
+                Err(e) => warn!("Crash db: bad record skipped: {}", e),
+            }
+        }
+        db
+    }
+
+    /// Record a hit of crash report, return bucket id of report and whether the
+    /// bucket is known before.
+    pub async fn record(&mut self, report: &str) -> (usize, bool) {
+        let title = title_of(report);
+        let now = Local::now();
+        let line = serde_json::to_string(&Record {
+            title: title.clone(),
+            time: now,
+        })
+        .unwrap();
+        if let Err(e) = append(CRASH_DB_PATH, line).await {
+            warn!("Crash db: fail to append {}: {}", CRASH_DB_PATH, e);
+        }
+        self.hit(title, now)
+    }
+
+    pub fn get(&self, id: usize) -> Option<&Bucket> {
+        self.buckets.get(id)
+    }
+
+    pub fn len(&self) -> usize {
+        self.buckets.len()
+    }
+
+    fn hit(&mut self, title: String, time: DateTime<Local>) -> (usize, bool) {
+        if let Some(&id) = self.index.get(&title) {
+            let b = &mut self.buckets[id];
+            b.hits += 1;
+            if time > b.last_seen {
+                b.last_seen = time;
+            }
+            (id, true)
+        } else {
+            let id = self.buckets.len();
+            self.index.insert(title.clone(), id);
+            self.buckets.push(Bucket {
+                id,
+                title,
+                first_seen: time,
+                last_seen: time,
+                hits: 1,
+            });
+            (id, false)
+        }
+    }
+}
+
+/// Title of report, digest of whole report if no oops line is found.
+pub fn title_of(report: &str) -> String {
+    report
+        .lines()
+        .map(|l| PREFIX.replace(l, ""))
+        .find(|l| TITLE.is_match(l))
+        .map(|l| {
+            let l = OFFSET.replace_all(&l, "");
+            NUM.replace_all(&l, "N").trim_end().to_string()
+        })
+        .unwrap_or_else(|| format!("unknown {:x}", md5::compute(report)))
+}
+
+async fn append(path: &str, mut line: String) -> std::io::Result<()> {
+    line.push('\n');
+    let mut f = OpenOptions::new()
+        .create(true)
+        .append(true)
+        .open(path)
+        .await?;
+    f.write_all(line.as_bytes()).await
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::crash_db::{title_of, CrashDb, Record};
+    use chrono::prelude::*;
+    use chrono::Duration;
+
+    #[test]
+    fn title() {
+        let report = "[   12.345678][ T123] BUG: KASAN: use-after-free in foo+0x1c/0x40\n\
+                      [   12.345679][ T123] Read of size 8 at addr ffff888012345678";
+        assert_eq!(title_of(report), "BUG: KASAN: use-after-free in foo");
+        let other = report.replace("T123", "T7").replace("0x1c", "0x2a");
+        assert_eq!(title_of(&other), title_of(report));
+        assert!(title_of("no oops here").starts_with("unknown "));
+    }
+
+    #[tokio::test]
+    async fn replay() {
+        let t0 = Local::now();
+        let t1 = t0 + Duration::seconds(1);
+        let mut data = String::new();
+        for (title, time) in &[("A", t0), ("B", t0), ("A", t1)] {
+            let r = Record {
+                title: (*title).to_string(),
+                time: *time,
+            };
+            data.push_str(&serde_json::to_string(&r).unwrap());
+            data.push('\n');
+        }
+        // torn record of interrupted append
+        data.push_str("{\"title\":\"C\"");
+        let path = std::env::temp_dir().join(format!("healer-crash-db-{}", std::process::id()));
+        std::fs::write(&path, data).unwrap();
+        let mut db = CrashDb::load(&path).await;
+        std::fs::remove_file(&path).unwrap();
+
+        assert_eq!(db.len(), 2);
+        let a = db.get(0).unwrap();
+        assert_eq!((a.title.as_str(), a.hits), ("A", 2));
+        assert_eq!((a.first_seen, a.last_seen), (t0, t1));
+        assert_eq!(db.get(1).unwrap().hits, 1);
+        assert_eq!(db.hit("B".to_string(), t1), (1, true));
+        assert_eq!(db.hit("C".to_string(), t1), (2, false));
+
+        let missing = CrashDb::load(std::env::temp_dir().join("healer-no-such-db")).await;
+        assert_eq!(missing.len(), 0);
+    }
+}
@@ -0,0 +1,449 @@
+//! Directed fuzzing
+//!
+//! Drive fuzzing toward some kernel functions, e.g. recently patched code.
+//! Call graph of vmlinux is recovered from direct calls and tail jumps in
+//! `objdump -d` output, distance of each function is the number of calls
+//! needed to reach a target. Traces are scored by the closest pc they cover,
+//! seeds closer to targets gain energy, and interfaces and groups whose calls
+//! came close are chosen more often by generation.
+use crate::filter::globs;
+use core::analyze::RTable;
+use core::prog::Prog;
+use core::target::Target;
+use fots::types::GroupId;
+use rand::{random, thread_rng, Rng};
+use std::collections::{HashMap, HashSet, VecDeque};
+use std::path::PathBuf;
+use std::process::{exit, Stdio};
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::Mutex;
+use tokio::io::{AsyncBufReadExt, BufReader};
+use tokio::process::Command;
+
+/// Distance of pcs that can't reach any target.
+pub const UNREACHABLE: u32 = u32::max_value();
+/// Max energy multiplier of seeds, for seeds covering targets.
+const DIST_BONUS: f64 = 4.0;
+/// Probability of choosing group by distance instead of randomly.
+const DIRECTED_GROUP_PROB: f64 = 0.5;
+
+#[derive(Debug, Clone, Deserialize)]
+pub struct DirectedConf {
+    /// Kernel image with symbols.
+    pub vmlinux: PathBuf,
+    /// Globs of target function names.
+    pub functions: Option<Vec<String>>,
+    /// Target pcs, functions containing them become targets.
+    pub pcs: Option<Vec<String>>,
+}
+
+impl DirectedConf {
+    pub fn check(&self) {
+        if !self.vmlinux.is_file() {
+            eprintln!(
+                "Config Error: directed vmlinux {} is invalid",
+                self.vmlinux.display()
+            );
+            exit(exitcode::CONFIG)
+        }
+        let functions = self.functions.as_ref().map(|f| f.len()).unwrap_or(0);
+        let pcs = self.pcs.as_ref().map(|p| p.len()).unwrap_or(0);
+        if functions + pcs == 0 {
+            eprintln!("Config Error: directed fuzzing requires target functions or pcs");
+            exit(exitcode::CONFIG)
+        }
+        for pc in self.pcs.iter().flatten() {
+            if parse_pc(pc).is_none() {
+                eprintln!("Config Error: invalid directed target pc \"{}\"", pc);
+                exit(exitcode::CONFIG)
+            }
+        }
+    }
+}
+
+/// Progress of directed fuzzing, persisted with scheduler state. Functions are
+/// indexed by address order, so it only applies to the same vmlinux.
+#[derive(Serialize, Deserialize)]
+pub struct DirectedState {
+    /// Number of functions of vmlinux.
+    fns: usize,
+    min_dist: u32,
+    reached: Vec<usize>,
+    groups: HashMap<GroupId, GroupDist>,
+}
+
+pub struct Directed {
+    /// Sorted start address of each function, with its index.
+    starts: Vec<(usize, usize)>,
+    /// End address of each function.
+    ends: Vec<usize>,
+    /// Distance of each function to closest target.
+    dists: Vec<u32>,
+    targets: usize,
+    /// Closest distance reached so far.
+    min_dist: AtomicU32,
+    /// Target functions covered so far.
+    reached: Mutex<HashSet<usize>>,
+    groups: Mutex<HashMap<GroupId, GroupDist>>,
+}
+
+/// Closest distance reached by each interface of a group.
+#[derive(Clone, Serialize, Deserialize)]
+struct GroupDist {
+    best: u32,
+    calls: Vec<u32>,
+}
+
+impl Directed {
+    pub async fn build(conf: &DirectedConf) -> Self {
+        let graph = CallGraph::load(&conf.vmlinux).await;
+
+        let patterns = globs(conf.functions.as_ref(), "^", "$");
+        let mut targets = graph
+            .names
+            .iter()
+            .enumerate()
+            .filter(|(_, name)| patterns.iter().any(|p| p.is_match(name)))
+            .map(|(i, _)| i)
+            .collect::<HashSet<_>>();
+        let mut d = Directed {
+            starts: graph.starts,
+            ends: graph.ends,
+            dists: Vec::new(),
+            targets: 0,
+            min_dist: AtomicU32::new(UNREACHABLE),
+            reached: Mutex::new(HashSet::new()),
+            groups: Mutex::new(HashMap::new()),
+        };
+        for pc in conf.pcs.iter().flatten().filter_map(|pc| parse_pc(pc)) {
+            match d.fn_of(pc) {
+                Some(f) => {
+                    targets.insert(f);
+                }
+                None => warn!("Directed: target pc {:#x} is not in any function", pc),
+            }
+        }
+        if targets.is_empty() {
+            exits!(exitcode::CONFIG, "Directed: no target function matched");
+        }
+
+        // bfs on reversed call graph
+        let mut dists = vec![UNREACHABLE; graph.names.len()];
+        let mut queue = VecDeque::new();
+        for &t in targets.iter() {
+            dists[t] = 0;
+            queue.push_back(t);
+        }
+        while let Some(f) = queue.pop_front() {
+            for &caller in graph.callers[f].iter() {
+                if dists[caller] == UNREACHABLE {
+                    dists[caller] = dists[f] + 1;
+                    queue.push_back(caller);
+                }
+            }
+        }
+        d.dists = dists;
+        d.targets = targets.len();
+        let reachable = d.dists.iter().filter(|&&d| d != UNREACHABLE).count();
+        info!(
+            "Directed: {} targets, {} of {} functions reach them",
+            d.targets,
+            reachable,
+            d.dists.len()
+        );
+        d
+    }
+
+    /// Distance of closest pc of trace, mark covered targets.
+    pub fn trace_distance(&self, pcs: &[usize]) -> u32 {
+        let mut min = UNREACHABLE;
+        let mut last_fn = None;
+        for &pc in pcs {
+            let f = match self.fn_of(pc) {
+                Some(f) => f,
+                None => continue,
+            };
+            // consecutive pcs are mostly in the same function
+            if last_fn == Some(f) {
+                continue;
+            }
+            last_fn = Some(f);
+            let d = self.dists[f];
+            if d == 0 {
+                self.reached.lock().unwrap().insert(f);
+            }
+            min = min.min(d);
+        }
+        let mut cur = self.min_dist.load(Ordering::Relaxed);
+        while min < cur {
+            match self.min_dist.compare_exchange_weak(
+                cur,
+                min,
+                Ordering::Relaxed,
+                Ordering::Relaxed,
+            ) {
+                Ok(_) => break,
+                Err(c) => cur = c,
+            }
+        }
+        min
+    }
+
+    /// Distance of each call of an exec result, by its coverage.
+    pub fn distances(&self, covs: &[Vec<usize>]) -> Vec<u32> {
+        covs.iter().map(|c| self.trace_distance(c)).collect()
+    }
+
+    /// Record distance reached by each call of p, dists are given by distances.
+    /// Return whether any interface of the group came closer.
+    pub fn record(&self, p: &Prog, dists: &[u32], t: &Target) -> bool {
+        let g = &t.groups[&p.gid];
+        let mut groups = self.groups.lock().unwrap();
+        let gd = groups.entry(p.gid).or_insert_with(|| GroupDist {
+            best: UNREACHABLE,
+            calls: vec![UNREACHABLE; g.fn_num()],
+        });
+        let mut closer = false;
+        for (c, &d) in p.calls.iter().zip(dists) {
+            if let Some(i) = g.index_by_id(c.fid) {
+                if d < gd.calls[i] {
+                    gd.calls[i] = d;
+                    closer = true;
+                }
+            }
+            gd.best = gd.best.min(d);
+        }
+        closer
+    }
+
+    pub fn dump(&self) -> DirectedState {
+        DirectedState {
+            fns: self.dists.len(),
+            min_dist: self.min_dist.load(Ordering::Relaxed),
+            reached: self.reached.lock().unwrap().iter().copied().collect(),
+            groups: self.groups.lock().unwrap().clone(),
+        }
+    }
+
+    /// Restore progress of last run, false if vmlinux changed since then.
+    /// Distances of groups whose interfaces changed are dropped.
+    pub fn restore(&self, state: DirectedState, t: &Target) -> bool {
+        if state.fns != self.dists.len() {
+            return false;
+        }
+        self.min_dist.store(state.min_dist, Ordering::Relaxed);
+        self.reached
+            .lock()
+            .unwrap()
+            .extend(state.reached.into_iter().filter(|&f| f < state.fns));
+        let mut groups = self.groups.lock().unwrap();
+        for (gid, gd) in state.groups {
+            let fn_num = t.groups.get(&gid).map(|g| g.fn_num());
+            if fn_num == Some(gd.calls.len()) {
+                groups.insert(gid, gd);
+            }
+        }
+        true
+    }
+
+    /// Choose group whose calls came close to targets, None for random choice.
+    pub fn choose_group(&self, rs: &HashMap<GroupId, RTable>) -> Option<GroupId> {
+        if random::<f64>() > DIRECTED_GROUP_PROB {
+            return None;
+        }
+        let groups = self.groups.lock().unwrap();
+        let candidates = groups
+            .iter()
+            .filter(|(gid, gd)| {
+                gd.best != UNREACHABLE && rs.get(*gid).map(|r| r.enabled_num() != 0) == Some(true)
+            })
+            .map(|(gid, gd)| (*gid, energy(gd.best)))
+            .collect::<Vec<_>>();
+        let total = candidates.iter().map(|(_, e)| e).sum::<f64>();
+        if candidates.is_empty() {
+            return None;
+        }
+        let mut p = thread_rng().gen_range(0.0, total);
+        for (gid, e) in candidates.iter() {
+            if p < *e {
+                return Some(*gid);
+            }
+            p -= e;
+        }
+        candidates.last().map(|(gid, _)| *gid)
+    }
+
+    /// Selection weight of each interface of group gid, by distance it reached.
+    pub fn call_weights(&self, gid: GroupId) -> Option<Vec<f64>> {
+        let groups = self.groups.lock().unwrap();
+        groups
+            .get(&gid)
+            .map(|gd| gd.calls.iter().map(|&d| energy(d)).collect())
+    }
+
+    /// Closest distance reached and number of targets covered.
+    pub fn progress(&self) -> (u32, usize, usize) {
+        let reached = self.reached.lock().unwrap().len();
+        (self.min_dist.load(Ordering::Relaxed), reached, self.targets)
+    }
+
+    fn fn_of(&self, pc: usize) -> Option<usize> {
+        let i = match self.starts.binary_search_by(|&(start, _)| start.cmp(&pc)) {
+            Ok(i) => i,
+            Err(0) => return None,
+            Err(i) => i - 1,
+        };
+        let f = self.starts[i].1;
+        if pc < self.ends[f] {
+            Some(f)
+        } else {
+            None
+        }
+    }
+}
+
+/// Energy multiplier of distance d, 1.0 for unreachable ones.
+pub fn energy(d: u32) -> f64 {
+    if d == UNREACHABLE {
+        1.0
+    } else {
+        1.0 + DIST_BONUS / (1.0 + f64::from(d))
+    }
+}
+
+struct CallGraph {
+    names: Vec<String>,
+    starts: Vec<(usize, usize)>,
+    ends: Vec<usize>,
+    /// Direct callers of each function.
+    callers: Vec<Vec<usize>>,
+}
+
+impl CallGraph {
+    /// Recover call graph from disassembly of vmlinux, which is too large to
+    /// be kept in memory, so it is parsed line by line. Symbol table comes
+    /// first, giving size of each function.
+    async fn load(vmlinux: &PathBuf) -> Self {
+        let mut objdump = Command::new("objdump")
+            .arg("-d")
+            .arg("-t")
+            .arg("--no-show-raw-insn")
+            .arg(vmlinux)
+            .stdout(Stdio::piped())
+            .spawn()
+            .unwrap_or_else(|e| exits!(exitcode::OSERR, "Fail to run objdump: {}", e));
+        let mut lines = BufReader::new(objdump.stdout.take().unwrap()).lines();
+
+        let mut names = Vec::new();
+        let mut index = HashMap::new();
+        let mut starts = Vec::new();
+        // start address to symbol size
+        let mut sizes = HashMap::new();
+        // (caller, callee name)
+        let mut calls = Vec::new();
+        while let Some(l) = lines
+            .next_line()
+            .await
+            .unwrap_or_else(|e| exits!(exitcode::IOERR, "Fail to read disassembly: {}", e))
+        {
+            // symbol table is before any disassembled function
+            if names.is_empty() {
+                if let Some((addr, size)) = parse_fn_symbol(&l) {
+                    let s = sizes.entry(addr).or_insert(0);
+                    *s = size.max(*s);
+                    continue;
+                }
+            }
+            if l.ends_with(">:") {
+                // ffffffff81000000 <startup_64>:
+                let mut fields = l.splitn(2, ' ');
+                let addr = fields
+                    .next()
+                    .and_then(|a| usize::from_str_radix(a, 16).ok());
+                let name = fields
+                    .next()
+                    .map(|n| n.trim_start_matches('<').trim_end_matches(">:"));
+                if let (Some(addr), Some(name)) = (addr, name) {
+                    let f = names.len();
+                    index.entry(name.to_string()).or_insert(f);
+                    names.push(name.to_string());
+                    starts.push((addr, f));
+                }
+            } else if let Some(f) = names.len().checked_sub(1) {
+                // ffffffff8100001c:	call   ffffffff81000100 <verify_cpu>
+                let insn = match l.split('\t').nth(1) {
+                    Some(insn) => insn,
+                    None => continue,
+                };
+                if insn.starts_with("call") || insn.starts_with("jmp") {
+                    if let (Some(s), Some(e)) = (insn.rfind('<'), insn.rfind('>')) {
+                        if s < e {
+                            let callee = insn[s + 1..e].split('+').next().unwrap();
+                            if callee != names[f] {
+                                calls.push((f, callee.to_string()));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        if let Err(e) = objdump.await {
+            exits!(exitcode::OSERR, "Fail to wait objdump: {}", e);
+        }
+        if names.is_empty() {
+            exits!(
+                exitcode::DATAERR,
+                "Fail to disassemble {}: no function found",
+                vmlinux.display()
+            );
+        }
+
+        let mut callers = vec![Vec::new(); names.len()];
+        for (caller, callee) in calls {
+            if let Some(&callee) = index.get(&callee) {
+                callers[callee].push(caller);
+            }
+        }
+        for c in callers.iter_mut() {
+            c.sort_unstable();
+            c.dedup();
+        }
+
+        starts.sort_unstable();
+        let mut ends = vec![0; names.len()];
+        for (i, &(start, f)) in starts.iter().enumerate() {
+            // Function without size ends at the next one, the last one has nothing.
+            ends[f] = match sizes.get(&start) {
+                Some(&size) if size != 0 => start + size,
+                _ => starts.get(i + 1).map(|&(next, _)| next).unwrap_or(start),
+            };
+        }
+        Self {
+            names,
+            starts,
+            ends,
+            callers,
+        }
+    }
+}
+
+/// Address and size of function symbol in symbol table of objdump, e.g.
+/// "ffffffff81000000 g     F .text\t0000000000000030 startup_64".
+fn parse_fn_symbol(l: &str) -> Option<(usize, usize)> {
+    let mut fields = l.splitn(2, '\t');
+    let head = fields.next()?.split_whitespace().collect::<Vec<_>>();
+    let size = fields.next()?.split_whitespace().next()?;
+    // address, flags.., section
+    if head.len() < 3 || !head[1..head.len() - 1].iter().any(|f| f.contains('F')) {
+        return None;
+    }
+    let addr = usize::from_str_radix(head[0], 16).ok()?;
+    let size = usize::from_str_radix(size, 16).ok()?;
+    Some((addr, size))
+}
+
+fn parse_pc(pc: &str) -> Option<usize> {
+    let pc = pc.trim();
+    let pc = pc.trim_start_matches("0x").trim_start_matches("0X");
+    usize::from_str_radix(pc, 16).ok()
+}
@@ -0,0 +1,88 @@
+//! Edge signal
+//!
+//! Branch signal is computed from every adjacent (prev, cur) pc pair of raw
+//! kcov trace. In `Hash` mode, full 64-bit width of both pcs are mixed, in
+//! `Exact` mode, a pair is packed losslessly when both pcs are in the same
+//! 4GiB window, which holds for kernel text and modules.
+use crate::feedback::Branch;
+
+/// Way of computing branch signal from pc pair.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+#[serde(rename_all = "lowercase")]
+pub enum EdgeMode {
+    Hash,
+    Exact,
+}
+
+impl Default for EdgeMode {
+    fn default() -> Self {
+        EdgeMode::Hash
+    }
+}
+
+/// Number of pairs hashed per iteration of batch loop.
+const LANES: usize = 4;
+
+/// Compute branch signal of every adjacent pair of trace, append them to out.
+pub fn edges(trace: &[usize], mode: EdgeMode, out: &mut Vec<Branch>) {
+    if trace.len() < 2 {
+        return;
+    }
+    out.reserve(trace.len() - 1);
+    let (prevs, curs) = (&trace[..trace.len() - 1], &trace[1..]);
+
+    match mode {
+        EdgeMode::Hash => {
+            // Fixed width lanes without data dependent branch, so that
+            // compiler is able to vectorize the mixing.
+            let mut prev_chunks = prevs.chunks_exact(LANES);
+            let mut cur_chunks = curs.chunks_exact(LANES);
+            for (p, c) in (&mut prev_chunks).zip(&mut cur_chunks) {
+                let mut lanes = [0usize; LANES];
+                for ((l, p), c) in lanes.iter_mut().zip(p).zip(c) {
+                    *l = hash_edge(*p, *c);
+                }
+                out.extend(lanes.iter().map(|l| Branch(*l)));
+            }
+            for (p, c) in prev_chunks.remainder().iter().zip(cur_chunks.remainder()) {
+                out.push(Branch(hash_edge(*p, *c)));
+            }
+        }
+        EdgeMode::Exact => {
+            for (p, c) in prevs.iter().zip(curs) {
+                out.push(Branch(edge(*p, *c, EdgeMode::Exact)));
+            }
+        }
+    }
+}
+
+/// Branch signal of single pc pair.
+#[inline]
+pub fn edge(prev: usize, cur: usize, mode: EdgeMode) -> usize {
+    match mode {
+        EdgeMode::Hash => hash_edge(prev, cur),
+        EdgeMode::Exact => {
+            let (prev, cur) = (prev as u64, cur as u64);
+            if prev >> 32 == cur >> 32 {
+                ((prev << 32) | (cur & 0xffff_ffff)) as usize
+            } else {
+                hash_edge(prev as usize, cur as usize)
+            }
+        }
+    }
+}
+
+#[inline]
+fn hash_edge(prev: usize, cur: usize) -> usize {
+    (mix(prev as u64) ^ cur as u64) as usize
+}
+
+/// Finalizer of splitmix64, every bit of input affects every bit of output.
+#[inline]
+pub(crate) fn mix(mut x: u64) -> u64 {
+    x ^= x >> 30;
+    x = x.wrapping_mul(0xbf58_476d_1ce4_e5b9);
+    x ^= x >> 27;
+    x = x.wrapping_mul(0x94d0_49bb_1331_11eb);
+    x ^ (x >> 31)
+}
@@ -6,18 +6,32 @@ use crate::Config;
 use core::c::to_prog;
 use core::prog::Prog;
 use core::target::Target;
-use executor::transfer::{async_recv_result, async_send};
-use executor::{ExecResult, Reason};
+use executor::probe::ProbeMsg;
+use executor::transfer::{async_recv, async_recv_result, async_send, async_send_prog};
+use executor::{ExecResult, ExecTimes, Reason};
+use fots::types::FnId;
 use std::env::temp_dir;
 use std::path::PathBuf;
 use std::process::exit;
+use std::sync::Arc;
+use std::time::Instant;
 use tokio::fs::write;
 use tokio::io::AsyncReadExt;
 use tokio::net::{TcpListener, TcpStream};
 use tokio::process::Child;
-use tokio::sync::oneshot;
+use tokio::sync::{oneshot, Mutex};
 use tokio::time::{delay_for, timeout, Duration};
 
+/// Latency of an exec, measured by fuzzer and reported by executor.
+#[derive(Debug, Clone, Copy)]
+pub struct ExecTiming {
+    /// Sending encoded prog.
+    pub send: Duration,
+    /// Waiting for result after prog is sent, executor time included.
+    pub wait: Duration,
+    pub executor: ExecTimes,
+}
+
 // config for executor
 #[derive(Debug, Clone, Deserialize)]
 pub struct ExecutorConf {
@@ -26,6 +40,8 @@ pub struct ExecutorConf {
     pub concurrency: bool,
     pub memleak_check: bool,
     pub script_mode: bool,
+    /// Probe interfaces at first start and disable failed ones.
+    pub probe: Option<bool>,
 }
 
 impl ExecutorConf {
@@ -53,6 +69,36 @@ impl ExecutorConf {
     }
 }
 
+/// Probe progress shared by executors of all guests, so interfaces are probed
+/// by one guest only, and a guest lost in the middle of probe resumes from
+/// where it stopped after reboot instead of starting over.
+#[derive(Debug, Default)]
+pub struct ProbeState {
+    /// Probed interfaces, sorted.
+    probed: Vec<FnId>,
+    disabled: Vec<FnId>,
+    finished: bool,
+    /// Boots in a row that made no progress.
+    stalls: usize,
+}
+
+pub type SharedProbe = Arc<Mutex<ProbeState>>;
+
+impl ProbeState {
+    /// Guest boots without progress before probe is given up.
+    const MAX_STALLS: usize = 3;
+
+    fn add(&mut self, fid: FnId, disabled: bool) {
+        if let Err(i) = self.probed.binary_search(&fid) {
+            self.probed.insert(i, fid);
+            if disabled {
+                self.disabled.push(fid);
+            }
+        }
+        self.stalls = 0;
+    }
+}
+
 pub struct Executor {
     inner: ExecutorImpl,
 }
@@ -63,11 +109,11 @@ enum ExecutorImpl {
 }
 
 impl Executor {
-    pub fn new(cfg: &Config) -> Self {
+    pub fn new(cfg: &Config, probe: SharedProbe) -> Self {
         let inner = if cfg.executor.script_mode {
             ExecutorImpl::Scripy(ScriptExecutor::new(cfg))
         } else {
-            ExecutorImpl::Linux(LinuxExecutor::new(cfg))
+            ExecutorImpl::Linux(LinuxExecutor::new(cfg, probe))
         };
         Self { inner }
     }
@@ -79,17 +125,42 @@ impl Executor {
         }
     }
 
+    /// Number of guest boots, including restarts.
+    pub fn boots(&self) -> usize {
+        match self.inner {
+            ExecutorImpl::Linux(ref e) => e.boots,
+            ExecutorImpl::Scripy(ref e) => e.boots,
+        }
+    }
+
     pub async fn exec(&mut self, p: &Prog, t: &Target) -> Result<ExecResult, Option<Crash>> {
         match self.inner {
-            ExecutorImpl::Linux(ref mut e) => e.exec(p).await,
+            ExecutorImpl::Linux(ref mut e) => e.exec(p, t).await,
             ExecutorImpl::Scripy(ref mut e) => e.exec(p, t).await,
         }
     }
+
+    /// Latency of last exec, None if it didn't get a result from executor.
+    pub fn take_timing(&mut self) -> Option<ExecTiming> {
+        match self.inner {
+            ExecutorImpl::Linux(ref mut e) => e.timing.take(),
+            ExecutorImpl::Scripy(_) => None,
+        }
+    }
+
+    /// Interfaces disabled by probe, None if probe is not done.
+    pub fn disabled(&self) -> Option<&[FnId]> {
+        match self.inner {
+            ExecutorImpl::Linux(ref e) => e.disabled.as_ref().map(|d| &d[..]),
+            ExecutorImpl::Scripy(_) => None,
+        }
+    }
 }
 
 struct ScriptExecutor {
     path_on_host: PathBuf,
     guest: Guest,
+    boots: usize,
 }
 
 impl ScriptExecutor {
@@ -99,10 +170,12 @@ impl ScriptExecutor {
         Self {
             path_on_host: cfg.executor.path.clone(),
             guest,
+            boots: 0,
         }
     }
 
     pub async fn start(&mut self) {
+        self.boots += 1;
         self.guest.boot().await;
     }
 
@@ -147,7 +220,7 @@ impl ScriptExecutor {
         if !result_line.is_empty() {
             let out = out.replace(&result_line, "");
             if result_line.contains("success") {
-                return Ok(ExecResult::Ok(Default::default()));
+                return Ok(ExecResult::Ok(Default::default(), Vec::new()));
             } else if result_line.contains("failed") {
                 return Ok(ExecResult::Failed(Reason(out)));
             } else if result_line.contains("crashed") {
@@ -158,7 +231,7 @@ impl ScriptExecutor {
         if !self.guest.is_alive().await {
             Err(Some(Crash { inner: out }))
         } else {
-            Ok(ExecResult::Ok(Default::default()))
+            Ok(ExecResult::Ok(Default::default(), Vec::new()))
         }
     }
 }
@@ -173,10 +246,20 @@ struct LinuxExecutor {
     executor_bin_path: PathBuf,
     target_path: PathBuf,
     host_ip: String,
+    /// Shared probe progress, None if probe is off.
+    probe: Option<SharedProbe>,
+    disabled: Option<Vec<FnId>>,
+    /// Buffer of encoded prog, reused by every send.
+    send_buf: Vec<u8>,
+    /// Buffer of exec result, reused by every recv.
+    recv_buf: Vec<u8>,
+    /// Number of guest boots.
+    boots: usize,
+    timing: Option<ExecTiming>,
 }
 
 impl LinuxExecutor {
-    pub fn new(cfg: &Config) -> Self {
+    pub fn new(cfg: &Config, probe: SharedProbe) -> Self {
         let guest = Guest::new(cfg);
         let port = free_ipv4_port()
             .unwrap_or_else(|| exits!(exitcode::TEMPFAIL, "No Free port for executor driver"));
@@ -198,18 +281,35 @@ impl LinuxExecutor {
             executor_bin_path: cfg.executor.path.clone(),
             target_path: PathBuf::from(&cfg.fots_bin),
             host_ip,
+            probe: if cfg.executor.probe.unwrap_or(false) {
+                Some(probe)
+            } else {
+                None
+            },
+            disabled: None,
+            send_buf: Vec::new(),
+            recv_buf: Vec::new(),
+            boots: 0,
+            timing: None,
         }
     }
 
     pub async fn start(&mut self) {
-        // handle should be set to kill on drop
-        self.exec_handle = None;
-        self.guest.boot().await;
+        // Guest is booted again if it's lost during probe, each boot gets further.
+        loop {
+            self.boots += 1;
+            // handle should be set to kill on drop
+            self.exec_handle = None;
+            self.guest.boot().await;
 
-        self.start_executer().await
+            if self.start_executer().await {
+                break;
+            }
+        }
     }
 
-    pub async fn start_executer(&mut self) {
+    /// Start executor in guest, false if guest is lost during probe and needs reboot.
+    pub async fn start_executer(&mut self) -> bool {
         use tokio::io::ErrorKind::*;
 
         self.exec_handle = None;
@@ -266,6 +366,22 @@ impl LinuxExecutor {
         if self.concurrency {
             executor.arg(Arg::new_flag("-c"));
         }
+        // Result of probe doesn't change, only probe at first start. Lock is held
+        // until probe is done, so executors of other guests wait and reuse it.
+        let probe = match self.probe {
+            Some(ref probe) if self.disabled.is_none() => Some(probe.clone()),
+            _ => None,
+        };
+        let mut probe_state = None;
+        if let Some(ref probe) = probe {
+            let state = probe.lock().await;
+            if state.finished {
+                self.disabled = Some(state.disabled.clone());
+            } else {
+                executor.arg(Arg::new_flag("-p"));
+                probe_state = Some(state);
+            }
+        }
 
         self.exec_handle = Some(self.guest.run_cmd(&executor).await);
         self.conn = match timeout(Duration::new(32, 0), rx).await {
@@ -276,14 +392,73 @@ impl LinuxExecutor {
             }
             Ok(conn) => Some(conn.unwrap()),
         };
+
+        if let Some(mut state) = probe_state {
+            if !self.drive_probe(&mut state).await {
+                return false;
+            }
+            self.disabled = Some(state.disabled.clone());
+        }
+        true
+    }
+
+    /// Drive probe of executor, record progress to state. Interface being probed
+    /// when guest is lost is disabled. Return false if guest is lost.
+    async fn drive_probe(&mut self, state: &mut ProbeState) -> bool {
+        const PROBE_TIMEOUT: Duration = Duration::from_secs(30);
+
+        let conn = self.conn.as_mut().unwrap();
+        let mut current = None;
+        if let Err(e) = async_send(&state.probed, conn).await {
+            warn!("Probe: fail to send probed interfaces: {}", e);
+        } else {
+            loop {
+                match timeout(PROBE_TIMEOUT, async_recv(conn)).await {
+                    Ok(Ok(ProbeMsg::Begin(fid))) => current = Some(fid),
+                    Ok(Ok(ProbeMsg::End(fid, disabled))) => {
+                        state.add(fid, disabled);
+                        current = None;
+                    }
+                    Ok(Ok(ProbeMsg::Finish)) => {
+                        state.finished = true;
+                        return true;
+                    }
+                    Ok(Err(e)) => {
+                        warn!("Probe: fail to recv: {}", e);
+                        break;
+                    }
+                    Err(_) => {
+                        warn!("Probe: time out");
+                        break;
+                    }
+                }
+            }
+        }
+
+        if let Some(fid) = current {
+            warn!("Probe: guest lost when probing interface {}, disabled", fid);
+            state.add(fid, true);
+        } else {
+            state.stalls += 1;
+            if state.stalls == ProbeState::MAX_STALLS {
+                warn!(
+                    "Probe: no progress after {} boots, the rest is not probed",
+                    state.stalls
+                );
+                state.finished = true;
+            }
+        }
+        false
     }
 
-    pub async fn exec(&mut self, p: &Prog) -> Result<ExecResult, Option<Crash>> {
+    pub async fn exec(&mut self, p: &Prog, t: &Target) -> Result<ExecResult, Option<Crash>> {
         // send must be success
         assert!(self.conn.is_some());
+        self.timing = None;
+        let start = Instant::now();
         if let Err(e) = timeout(
             Duration::new(15, 0),
-            async_send(p, self.conn.as_mut().unwrap()),
+            async_send_prog(p, t, &mut self.send_buf, self.conn.as_mut().unwrap()),
         )
         .await
         {
@@ -292,10 +467,11 @@ impl LinuxExecutor {
             return Ok(ExecResult::Failed(Reason("Prog send blocked".into())));
         }
         // async_send(p, self.conn.as_mut().unwrap()).await.unwrap();
+        let send = start.elapsed();
         let ret = {
             match timeout(
                 Duration::new(15, 0),
-                async_recv_result(self.conn.as_mut().unwrap()),
+                async_recv_result(self.conn.as_mut().unwrap(), &mut self.recv_buf),
             )
             .await
             {
@@ -308,7 +484,12 @@ impl LinuxExecutor {
             }
         };
         match ret {
-            Ok(result) => {
+            Ok((result, executor)) => {
+                self.timing = Some(ExecTiming {
+                    send,
+                    wait: start.elapsed() - send,
+                    executor,
+                });
                 self.guest.clear().await;
                 if let ExecResult::Failed(ref reason) = result {
                     let rea = reason.to_string();
@@ -351,11 +532,13 @@ impl LinuxExecutor {
                         String::from_utf8(out).unwrap(),
                         String::from_utf8(err).unwrap()
                     );
-                    self.start_executer().await;
+                    if !self.start_executer().await {
+                        self.start().await;
+                    }
                 }
             }
         }
         // Caused by internal err
-        Ok(ExecResult::Ok(Vec::new()))
+        Ok(ExecResult::Ok(Vec::new(), Vec::new()))
     }
 }
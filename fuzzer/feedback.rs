@@ -1,9 +1,18 @@
+use crate::edge::{mix, EdgeMode};
+use crate::hitcount::{HitCounter, HitMap, NewHits};
 use std::collections::HashSet;
 use std::iter::Extend;
+use std::sync::atomic::{AtomicU32, Ordering};
 use tokio::sync::Mutex;
 
+/// Version of persisted coverage format.
+const SNAPSHOT_VERSION: u32 = 3;
+
+/// Number of block hit counters, must be power of 2.
+const HIT_SLOTS: usize = 1 << 16;
+
 #[derive(Clone, Debug, Default, Hash, PartialOrd, PartialEq, Ord, Eq)]
-pub struct Block(usize);
+pub struct Block(pub(crate) usize);
 
 impl From<usize> for Block {
     fn from(raw: usize) -> Self {
@@ -12,29 +21,30 @@ impl From<usize> for Block {
 }
 
 #[derive(Clone, Debug, Default, Hash, PartialOrd, PartialEq, Ord, Eq)]
-pub struct Branch(usize);
-
-impl From<(Block, Block)> for Branch {
-    fn from((b1, b2): (Block, Block)) -> Self {
-        let mut a = b1.0 as u32;
-        // hash algorithm from syzkaller
-        a = (a ^ 61) ^ (a >> 16);
-        a = a + (a << 3);
-        a = a ^ (a >> 4);
-        a *= 0x27d4_eb2d;
-        a = a ^ (a >> 15);
-
-        Self(a as usize ^ b2.0)
-    }
-}
+pub struct Branch(pub(crate) usize);
 
 #[derive(Default)]
 pub struct FeedBack {
     branches: Mutex<HashSet<Branch>>,
     blocks: Mutex<HashSet<Block>>,
+    /// Buckets seen by every branch, None if hitcount is disabled.
+    hits: Mutex<Option<HitMap>>,
+    /// How many executions have hit each block.
+    block_hits: BlockHits,
 }
 
 impl FeedBack {
+    pub fn new(hitcount: bool) -> Self {
+        Self {
+            hits: Mutex::new(if hitcount {
+                Some(HitMap::default())
+            } else {
+                None
+            }),
+            ..Default::default()
+        }
+    }
+
     pub async fn diff_branch(&self, branches: &[Branch]) -> HashSet<Branch> {
         let inner = self.branches.lock().await;
 
@@ -61,6 +71,47 @@ impl FeedBack {
         result
     }
 
+    /// Count one hit for each of deduped blocks of an executed call.
+    pub fn record_hits(&self, blocks: &[Block]) {
+        for b in blocks {
+            self.block_hits.0[b.slot() as usize].fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// Counter slots of at most n least hit blocks, rarest first.
+    pub fn rarest(&self, blocks: &[Block], n: usize) -> Vec<u32> {
+        let mut slots = blocks
+            .iter()
+            .map(|b| (self.block_hits.get(b.slot()), b.slot()))
+            .collect::<Vec<_>>();
+        slots.sort_unstable();
+        slots.dedup_by_key(|(_, s)| *s);
+        slots.truncate(n);
+        slots.into_iter().map(|(_, s)| s).collect()
+    }
+
+    /// Rarity of blocks behind slots, a block hit n times weighs 1/n.
+    pub fn rarity(&self, slots: &[u32]) -> f64 {
+        slots
+            .iter()
+            .map(|s| 1.0 / f64::from(self.block_hits.get(*s).max(1)))
+            .sum()
+    }
+
+    /// Buckets of call counted by counter that are new, always None if hitcount
+    /// is disabled.
+    pub async fn diff_hits(&self, counter: &mut HitCounter) -> Option<NewHits> {
+        let inner = self.hits.lock().await;
+        inner.as_ref().and_then(|seen| counter.new_hits(seen))
+    }
+
+    pub async fn merge_hits(&self, hits: &NewHits) {
+        let mut inner = self.hits.lock().await;
+        if let Some(seen) = inner.as_mut() {
+            seen.merge(hits);
+        }
+    }
+
     pub async fn merge(&self, blocks: HashSet<Block>, branches: HashSet<Branch>) {
         {
             let mut inner = self.branches.lock().await;
@@ -86,6 +137,76 @@ impl FeedBack {
         block_empty || branch_empty
     }
 
+    /// Dump blocks and branches in compact format, see `encode_set`.
+    /// Branches are only meaningful with the edge mode they're computed in.
+    /// Locks are only held while copying, sorting and encoding are done after.
+    pub async fn dump(&self, mode: EdgeMode) -> bincode::Result<Vec<u8>> {
+        let blocks = {
+            let inner = self.blocks.lock().await;
+            inner.iter().map(|b| b.0).collect::<Vec<_>>()
+        };
+        let blocks = encode_set(blocks.into_iter());
+        let branches = {
+            let inner = self.branches.lock().await;
+            inner.iter().map(|b| b.0).collect::<Vec<_>>()
+        };
+        let branches = encode_set(branches.into_iter());
+        let hits = {
+            let inner = self.hits.lock().await;
+            inner
+                .as_ref()
+                .map(|h| h.as_bytes().to_vec())
+                .unwrap_or_default()
+        };
+        bincode::serialize(&Snapshot {
+            version: SNAPSHOT_VERSION,
+            mode,
+            blocks,
+            branches,
+            hits,
+        })
+    }
+
+    /// Load dumped feedback, branches computed in other edge mode are dropped.
+    pub fn load(data: &[u8], mode: EdgeMode, hitcount: bool) -> bincode::Result<Self> {
+        let snapshot: Snapshot = bincode::deserialize(data)?;
+        if snapshot.version != SNAPSHOT_VERSION {
+            return Err(Box::new(bincode::ErrorKind::Custom(format!(
+                "unsupported feedback version {}",
+                snapshot.version
+            ))));
+        }
+        let mut blocks = decode_set(&snapshot.blocks)?
+            .map(Block)
+            .collect::<HashSet<_>>();
+        let mut branches = if snapshot.mode == mode {
+            decode_set(&snapshot.branches)?
+                .map(Branch)
+                .collect::<HashSet<_>>()
+        } else {
+            warn!(
+                "Feedback: edge mode changed ({:?} => {:?}), branches dropped",
+                snapshot.mode, mode
+            );
+            HashSet::new()
+        };
+        blocks.shrink_to_fit();
+        branches.shrink_to_fit();
+        let hits = if !hitcount {
+            None
+        } else if snapshot.mode == mode {
+            HitMap::from_bytes(snapshot.hits).or_else(|| Some(HitMap::default()))
+        } else {
+            Some(HitMap::default())
+        };
+        Ok(Self {
+            blocks: Mutex::new(blocks),
+            branches: Mutex::new(branches),
+            hits: Mutex::new(hits),
+            block_hits: BlockHits::default(),
+        })
+    }
+
     pub async fn len(&self) -> (usize, usize) {
         tokio::join!(
             async {
@@ -99,3 +220,130 @@ impl FeedBack {
         )
     }
 }
+
+impl Block {
+    /// Slot of hit counter, different blocks may share one.
+    #[inline]
+    fn slot(&self) -> u32 {
+        (mix(self.0 as u64) as usize & (HIT_SLOTS - 1)) as u32
+    }
+}
+
+/// Dense table of hit counters indexed by block slot, updated without lock.
+struct BlockHits(Box<[AtomicU32]>);
+
+impl Default for BlockHits {
+    fn default() -> Self {
+        Self((0..HIT_SLOTS).map(|_| AtomicU32::new(0)).collect())
+    }
+}
+
+impl BlockHits {
+    #[inline]
+    fn get(&self, slot: u32) -> u32 {
+        self.0[slot as usize].load(Ordering::Relaxed)
+    }
+}
+
+#[derive(Serialize, Deserialize)]
+struct Snapshot {
+    version: u32,
+    mode: EdgeMode,
+    blocks: Vec<u8>,
+    branches: Vec<u8>,
+    /// Raw bucket map, empty if hitcount is disabled.
+    hits: Vec<u8>,
+}
+
+/// Encode set of pcs as sorted deltas in LEB128 varint.
+///
+/// Kernel pcs are dense, so most deltas fit in one or two bytes,
+/// which is far smaller than eight bytes per pc.
+fn encode_set(vals: impl Iterator<Item = usize>) -> Vec<u8> {
+    let mut vals = vals.collect::<Vec<_>>();
+    vals.sort_unstable();
+
+    let mut buf = Vec::with_capacity(vals.len() * 2);
+    let mut prev = 0;
+    for v in vals {
+        let mut delta = v - prev;
+        prev = v;
+        loop {
+            let byte = (delta & 0x7f) as u8;
+            delta >>= 7;
+            if delta == 0 {
+                buf.push(byte);
+                break;
+            }
+            buf.push(byte | 0x80);
+        }
+    }
+    buf.shrink_to_fit();
+    buf
+}
+
+fn decode_set(buf: &[u8]) -> bincode::Result<impl Iterator<Item = usize> + '_> {
+    if buf.last().map(|b| b & 0x80 != 0).unwrap_or(false) {
+        return Err(Box::new(bincode::ErrorKind::Custom(
+            "truncated feedback data".into(),
+        )));
+    }
+
+    let mut bytes = buf.iter();
+    let mut prev = 0usize;
+    Ok(std::iter::from_fn(move || {
+        let mut delta = 0usize;
+        let mut shift = 0;
+        loop {
+            let byte = *bytes.next()?;
+            delta |= ((byte & 0x7f) as usize) << shift;
+            shift += 7;
+            if byte & 0x80 == 0 {
+                break;
+            }
+        }
+        prev += delta;
+        Some(prev)
+    }))
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::edge::EdgeMode;
+    use crate::feedback::{Block, Branch, FeedBack};
+    use crate::hitcount::HitCounter;
+
+    #[tokio::test]
+    async fn snapshot_round_trip() {
+        let blocks = vec![
+            Block(1),
+            Block(0xffff_ffff_8100_0000),
+            Block(0xffff_ffff_8100_0010),
+        ];
+        let branches = vec![Branch(0), Branch(42), Branch(usize::max_value())];
+        let f = FeedBack::new(true);
+        f.merge(
+            blocks.iter().cloned().collect(),
+            branches.iter().cloned().collect(),
+        )
+        .await;
+        let mut counter = HitCounter::default();
+        counter.count(&branches);
+        let hits = f.diff_hits(&mut counter).await.unwrap();
+        f.merge_hits(&hits).await;
+
+        let data = f.dump(EdgeMode::Exact).await.unwrap();
+        let loaded = FeedBack::load(&data, EdgeMode::Exact, true).unwrap();
+        assert_eq!(loaded.len().await, (blocks.len(), branches.len()));
+        assert!(loaded.diff_block(&blocks).await.is_empty());
+        assert!(loaded.diff_branch(&branches).await.is_empty());
+        counter.count(&branches);
+        assert!(loaded.diff_hits(&mut counter).await.is_none());
+
+        // Branches of other edge mode are dropped, blocks are kept.
+        let loaded = FeedBack::load(&data, EdgeMode::Hash, false).unwrap();
+        assert_eq!(loaded.len().await, (blocks.len(), 0));
+
+        assert!(FeedBack::load(&data[..data.len() - 1], EdgeMode::Exact, true).is_err());
+    }
+}
@@ -0,0 +1,224 @@
+//! Coverage filter
+//!
+//! Focus a campaign on some subsystems. Pc ranges given directly, and ranges of
+//! functions whose name or source file matches given globs, are merged into a
+//! `CoverFilter`. Symbols are resolved with `nm` against vmlinux.
+//!
+//! Executor sends the whole trace, and fuzzer filters blocks and branches computed
+//! from it. Edges are still those of the real trace, and directed fuzzing still
+//! sees pcs out of the filter.
+use regex::Regex;
+use std::path::PathBuf;
+use std::process::exit;
+use tokio::process::Command;
+
+#[derive(Debug, Clone, Deserialize)]
+pub struct FilterConf {
+    /// Kernel image with symbols, needed by functions and files.
+    pub vmlinux: Option<PathBuf>,
+    /// Pc ranges, e.g. "0xffffffff81000000-0xffffffff81100000".
+    pub ranges: Option<Vec<String>>,
+    /// Globs of function names, e.g. "ext4_*".
+    pub functions: Option<Vec<String>>,
+    /// Globs of source files, e.g. "fs/ext4/*".
+    pub files: Option<Vec<String>>,
+}
+
+impl FilterConf {
+    pub fn check(&self) {
+        let functions = self.functions.as_ref().map(|f| !f.is_empty());
+        let files = self.files.as_ref().map(|f| !f.is_empty());
+        let need_symbols = functions.unwrap_or(false) || files.unwrap_or(false);
+        if need_symbols {
+            match self.vmlinux.as_ref() {
+                Some(vmlinux) if vmlinux.is_file() => (),
+                Some(vmlinux) => {
+                    eprintln!(
+                        "Config Error: cover_filter vmlinux {} is invalid",
+                        vmlinux.display()
+                    );
+                    exit(exitcode::CONFIG)
+                }
+                None => {
+                    eprintln!("Config Error: cover_filter functions and files require vmlinux");
+                    exit(exitcode::CONFIG)
+                }
+            }
+        }
+
+        let ranges = self.ranges.as_ref().map(|r| !r.is_empty());
+        if !need_symbols && !ranges.unwrap_or(false) {
+            eprintln!("Config Error: cover_filter is empty, ranges, functions or files required");
+            exit(exitcode::CONFIG)
+        }
+        for r in self.ranges.iter().flatten() {
+            if parse_range(r).is_none() {
+                eprintln!(
+                    "Config Error: invalid cover_filter range \"{}\", \"0xstart-0xend\" required",
+                    r
+                );
+                exit(exitcode::CONFIG)
+            }
+        }
+    }
+
+    /// Resolve all rules to pc ranges.
+    pub async fn build(&self) -> CoverFilter {
+        let mut ranges = self
+            .ranges
+            .iter()
+            .flatten()
+            .filter_map(|r| parse_range(r))
+            .collect::<Vec<_>>();
+
+        let functions = globs(self.functions.as_ref(), "^", "$");
+        let files = globs(self.files.as_ref(), "(^|/)", "$");
+        if !functions.is_empty() || !files.is_empty() {
+            let vmlinux = self.vmlinux.as_ref().unwrap();
+            for sym in symbols(vmlinux, !files.is_empty()).await {
+                let hit = functions.iter().any(|f| f.is_match(&sym.name))
+                    || sym
+                        .file
+                        .as_ref()
+                        .map(|file| files.iter().any(|f| f.is_match(file)))
+                        .unwrap_or(false);
+                if hit {
+                    ranges.push((sym.addr, sym.addr + sym.size));
+                }
+            }
+        }
+
+        let filter = CoverFilter::new(ranges);
+        if filter.is_empty() {
+            exits!(exitcode::CONFIG, "Cover filter: no pc matched");
+        }
+        filter
+    }
+}
+
+/// Pc ranges coverage is restricted to.
+#[derive(Debug, Clone, Default)]
+pub struct CoverFilter {
+    /// Sorted, disjoint [start, end) ranges.
+    ranges: Vec<(usize, usize)>,
+}
+
+impl CoverFilter {
+    pub fn new(mut ranges: Vec<(usize, usize)>) -> Self {
+        ranges.retain(|(start, end)| start < end);
+        ranges.sort_unstable();
+        let mut merged: Vec<(usize, usize)> = Vec::with_capacity(ranges.len());
+        for (start, end) in ranges {
+            match merged.last_mut() {
+                Some(last) if start <= last.1 => last.1 = last.1.max(end),
+                _ => merged.push((start, end)),
+            }
+        }
+        merged.shrink_to_fit();
+        Self { ranges: merged }
+    }
+
+    pub fn contains(&self, pc: usize) -> bool {
+        match self.ranges.binary_search_by(|&(start, _)| start.cmp(&pc)) {
+            Ok(_) => true,
+            Err(0) => false,
+            Err(i) => pc < self.ranges[i - 1].1,
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.ranges.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.ranges.is_empty()
+    }
+}
+
+struct Symbol {
+    addr: usize,
+    size: usize,
+    name: String,
+    /// Source file, only resolved when filtering by files.
+    file: Option<String>,
+}
+
+/// Text symbols with size of vmlinux, source file of each symbol is looked up
+/// in debug info with `-l`, which is much slower.
+async fn symbols(vmlinux: &PathBuf, with_file: bool) -> Vec<Symbol> {
+    let mut nm = Command::new("nm");
+    nm.arg("--defined-only").arg("-S");
+    if with_file {
+        nm.arg("-l");
+    }
+    let out = nm
+        .arg(vmlinux)
+        .output()
+        .await
+        .unwrap_or_else(|e| exits!(exitcode::OSERR, "Fail to run nm: {}", e));
+    if !out.status.success() {
+        exits!(
+            exitcode::DATAERR,
+            "Fail to read symbols of {}: {}",
+            vmlinux.display(),
+            String::from_utf8_lossy(&out.stderr)
+        );
+    }
+
+    // addr size type name [file:line]
+    String::from_utf8_lossy(&out.stdout)
+        .lines()
+        .filter_map(|l| {
+            let mut fields = l.split_whitespace();
+            let addr = usize::from_str_radix(fields.next()?, 16).ok()?;
+            let size = usize::from_str_radix(fields.next()?, 16).ok()?;
+            if !fields.next()?.eq_ignore_ascii_case("t") {
+                return None;
+            }
+            let name = fields.next()?.to_string();
+            let file = fields
+                .next()
+                .map(|f| f.rsplitn(2, ':').last().unwrap_or(f).to_string());
+            Some(Symbol {
+                addr,
+                size,
+                name,
+                file,
+            })
+        })
+        .collect()
+}
+
+pub(crate) fn globs(globs: Option<&Vec<String>>, prefix: &str, suffix: &str) -> Vec<Regex> {
+    globs
+        .into_iter()
+        .flatten()
+        .map(|g| {
+            let mut re = String::from(prefix);
+            for c in g.chars() {
+                match c {
+                    '*' => re.push_str(".*"),
+                    '?' => re.push('.'),
+                    c => re.push_str(&regex::escape(&c.to_string())),
+                }
+            }
+            re.push_str(suffix);
+            Regex::new(&re).unwrap()
+        })
+        .collect()
+}
+
+fn parse_range(r: &str) -> Option<(usize, usize)> {
+    let mut bounds = r.splitn(2, '-').map(|b| {
+        let b = b.trim();
+        let b = b.trim_start_matches("0x").trim_start_matches("0X");
+        usize::from_str_radix(b, 16).ok()
+    });
+    let start = bounds.next()??;
+    let end = bounds.next()??;
+    if start < end {
+        Some((start, end))
+    } else {
+        None
+    }
+}
@@ -1,62 +1,163 @@
-use crate::corpus::Corpus;
-use crate::exec::Executor;
+use crate::corpus::{Corpus, Dump};
+use crate::crash_db::CrashDb;
+use crate::directed::{Directed, DirectedState, UNREACHABLE};
+use crate::edge::{edges, EdgeMode};
+use crate::exec::{ExecTiming, Executor};
 use crate::feedback::{Block, Branch, FeedBack};
+use crate::filter::CoverFilter;
 use crate::guest::Crash;
+use crate::hitcount::{HitCounter, NewHits};
+use crate::length::{LenControl, LenStat};
 use crate::report::TestCaseRecord;
-use crate::stats::StatSource;
+use crate::stats::{Latency, Stage, StatSource, VmStats};
 use crate::utils::queue::CQueue;
 use crate::Config;
 use core::analyze::prog_analyze;
+use core::analyze::removal_analyze;
 use core::analyze::static_analyze;
-use core::analyze::RTable;
+use core::analyze::{LearnedRelations, RTable};
 use core::c::to_prog;
-use core::gen::gen;
-use core::minimize::remove;
+use core::gen::{choose_group, gen_prog, Config as GenConfig, StrPool};
+use core::minimize::{remove, simplify};
 use core::mutate::mutate;
 use core::prog::Prog;
 use core::target::Target;
 use executor::{ExecResult, Reason};
-use fots::types::GroupId;
-use itertools::Itertools;
+use fots::types::{FnId, GroupId};
+use rand::{thread_rng, Rng};
 use regex::Regex;
 use std::collections::{HashMap, HashSet};
 use std::sync::atomic::{AtomicUsize, Ordering};
 use std::sync::Arc;
-use tokio::fs::write;
+use std::time::Instant;
+use tokio::fs::{rename, write, OpenOptions};
+use tokio::io::AsyncWriteExt;
 use tokio::sync::broadcast;
 use tokio::sync::Mutex;
+use tokio::time::{delay_for, Duration};
+
+/// Default ratio of corpus re-executed after feedback is restored.
+const DEFAULT_RECHECK_RATIO: f64 = 0.05;
+/// Number of rarest blocks kept for computing energy of each seed.
+const SEED_SLOTS: usize = 32;
+/// Max share of execs of each vm spent on simplifying corpus progs.
+const SIMPLIFY_BUDGET: f64 = 0.05;
+/// Max execs spent on simplifying values of one prog.
+const SIMPLIFY_MAX_EXEC: usize = 64;
+
+/// State of length control and directed fuzzing, persisted so that a new run
+/// doesn't learn them again.
+#[derive(Serialize, Deserialize)]
+pub struct SchedulerState {
+    length: HashMap<GroupId, LenStat>,
+    directed: Option<DirectedState>,
+}
 
 #[derive(Clone)]
 pub struct Fuzzer {
     pub target: Arc<Target>,
     pub rt: Arc<Mutex<HashMap<GroupId, RTable>>>,
-    pub conf: core::gen::Config,
+    /// Generation config of each group, adjusted by coverage of progs of each length.
+    pub length: Arc<LenControl>,
     pub corpus: Arc<Corpus>,
     pub feedback: Arc<FeedBack>,
+    pub edge_mode: EdgeMode,
+    pub hitcount: bool,
+    /// Blocks and branches out of filter are dropped from signal.
+    pub cover_filter: Option<Arc<CoverFilter>>,
     pub candidates: Arc<CQueue<Prog>>,
+    /// Sample of restored corpus to re-execute, progs that no longer cover anything are dropped.
+    pub recheck: Arc<CQueue<Prog>>,
+    /// Corpus progs whose values are not simplified yet, with their new blocks and branches
+    /// and id of their test case.
+    pub simplify_queue: Arc<CQueue<(Prog, HashSet<Block>, HashSet<Branch>, usize)>>,
     pub record: Arc<TestCaseRecord>,
-    pub exec_cnt: Arc<AtomicUsize>,
-    pub crash_digests: Arc<Mutex<HashSet<md5::Digest>>>,
+    /// Counters of each vm, indexed by vm id.
+    pub vms: Arc<Vec<VmStats>>,
+    /// Hits and lookups of string pools of all vms.
+    pub str_hits: Arc<AtomicUsize>,
+    pub str_lookups: Arc<AtomicUsize>,
+    /// Calls of fuzzed progs whose coverage is truncated by full kcov buffer.
+    pub cover_overflows: Arc<AtomicUsize>,
+    /// Distances to targets, if fuzzing is directed.
+    pub directed: Option<Arc<Directed>>,
+    /// Crash buckets of this and previous runs.
+    pub crash_db: Arc<Mutex<CrashDb>>,
+    /// Serializes checkpoints and final persisting, which write the same files.
+    persist_lock: Arc<Mutex<()>>,
+    /// Bumped by every change of persisted state, so checkpoints with nothing new
+    /// are skipped.
+    generation: Arc<AtomicUsize>,
 
     pub suppressions: Vec<Regex>,
     pub ignores: Vec<Regex>,
 }
 
 impl Fuzzer {
-    pub fn new(target: Target, candidates: Vec<Prog>, cfg: &Config) -> Self {
+    pub fn new(
+        target: Target,
+        candidates: Vec<Prog>,
+        feedback: Option<FeedBack>,
+        relations: Option<HashMap<GroupId, LearnedRelations>>,
+        directed: Option<Directed>,
+        cover_filter: Option<CoverFilter>,
+        crash_db: CrashDb,
+        cfg: &Config,
+    ) -> Self {
         let target = Arc::new(target);
         let record = Arc::new(TestCaseRecord::new(target.clone()));
-        let rt = static_analyze(&target);
+        let mut rt = static_analyze(&target);
+        if let Some(relations) = relations {
+            for (gid, l) in relations.iter() {
+                let restored = rt
+                    .get_mut(gid)
+                    .map(|r| r.restore_learned(l))
+                    .unwrap_or(false);
+                if !restored {
+                    warn!(
+                        "Relations: group {} changed, learned relations dropped",
+                        gid
+                    );
+                }
+            }
+        }
+        let hitcount = cfg.hitcount.unwrap_or(false);
+        // Coverage of corpus is restored, every prog is kept and only a sample of it
+        // is re-executed.
+        let (corpus, recheck, candidates) = if feedback.is_some() {
+            let ratio = cfg.recheck_ratio.unwrap_or(DEFAULT_RECHECK_RATIO);
+            let mut rng = thread_rng();
+            let recheck = candidates
+                .iter()
+                .filter(|_| rng.gen::<f64>() < ratio)
+                .cloned()
+                .collect();
+            (Corpus::from(candidates), recheck, Vec::new())
+        } else {
+            (Corpus::default(), Vec::new(), candidates)
+        };
+
         Self {
             target,
             record,
-            crash_digests: Arc::new(Mutex::new(HashSet::new())),
-            exec_cnt: Arc::new(AtomicUsize::new(0)),
+            crash_db: Arc::new(Mutex::new(crash_db)),
+            persist_lock: Arc::new(Mutex::new(())),
+            generation: Arc::new(AtomicUsize::new(0)),
+            vms: Arc::new((0..cfg.vm_num).map(|_| VmStats::default()).collect()),
+            str_hits: Arc::new(AtomicUsize::new(0)),
+            str_lookups: Arc::new(AtomicUsize::new(0)),
+            cover_overflows: Arc::new(AtomicUsize::new(0)),
+            directed: directed.map(Arc::new),
             rt: Arc::new(Mutex::new(rt)),
-            conf: Default::default(),
+            length: Arc::new(LenControl::new(cfg.gen.as_ref())),
             candidates: Arc::new(CQueue::from(candidates)),
-            corpus: Arc::new(Corpus::default()),
-            feedback: Arc::new(FeedBack::default()),
+            recheck: Arc::new(CQueue::from(recheck)),
+            simplify_queue: Arc::new(CQueue::default()),
+            corpus: Arc::new(corpus),
+            feedback: Arc::new(feedback.unwrap_or_else(|| FeedBack::new(hitcount))),
+            edge_mode: cfg.edge_mode.unwrap_or_default(),
+            hitcount,
+            cover_filter: cover_filter.map(Arc::new),
 
             suppressions: cfg
                 .suppressions
@@ -75,57 +176,208 @@ impl Fuzzer {
         }
     }
 
+    /// Restore length control and directed progress persisted by last run.
+    pub async fn restore_scheduler(&self, state: SchedulerState) {
+        self.length.restore(state.length).await;
+        if let (Some(directed), Some(state)) = (self.directed.as_ref(), state.directed) {
+            if !directed.restore(state, &self.target) {
+                warn!("Scheduler: vmlinux changed, directed progress dropped");
+            }
+        }
+    }
+
+    /// Mask out interfaces that failed probe of executor.
+    pub async fn disable(&self, fids: &[FnId]) {
+        let mut rt = self.rt.lock().await;
+        let mut n = 0;
+        for g in self.target.iter_group() {
+            let r = rt.get_mut(&g.id).unwrap();
+            for fid in fids {
+                if let Some(i) = g.index_by_id(*fid) {
+                    if r.disable(i) {
+                        n += 1;
+                    }
+                }
+            }
+        }
+        if n != 0 {
+            info!("Probe: {} interfaces disabled", n);
+        }
+    }
+
     pub fn stats(&self) -> StatSource {
         StatSource {
-            exec: self.exec_cnt.clone(),
+            vms: self.vms.clone(),
+            str_hits: self.str_hits.clone(),
+            str_lookups: self.str_lookups.clone(),
+            cover_overflows: self.cover_overflows.clone(),
+            directed: self.directed.clone(),
             corpus: self.corpus.clone(),
             feedback: self.feedback.clone(),
+            rt: self.rt.clone(),
             candidates: self.candidates.clone(),
             record: self.record.clone(),
         }
     }
-    pub async fn fuzz(self, executor: Executor, mut shutdown: broadcast::Receiver<()>) {
+    pub async fn fuzz(self, vm: usize, executor: Executor, mut shutdown: broadcast::Receiver<()>) {
         tokio::select! {
             _ = shutdown.recv() => (),
-            _ = self.do_fuzz(executor) => ()
+            _ = self.do_fuzz(vm, executor) => ()
         }
     }
 
-    async fn do_fuzz(&self, mut executor: Executor) {
+    async fn do_fuzz(&self, vm: usize, mut executor: Executor) {
+        let stats = &self.vms[vm];
         let mut gen_cnt = 0;
+        // Strings of progs executed on this vm, files they name may exist in guest.
+        let mut strs = StrPool::default();
+        let mut hits = HitCounter::default();
         loop {
-            let p = self.get_prog(&mut gen_cnt).await;
-            match executor.exec(&p, &self.target).await {
+            // A simplified prog is only cheaper to exec, so simplifying waits
+            // whenever it takes more than its share of execs.
+            let budget = stats.total_execs() as f64 * SIMPLIFY_BUDGET;
+            if stats.execs(Stage::Simplify) as f64 <= budget {
+                if let Some((p, blocks, branches, id)) = self.simplify_queue.pop().await {
+                    let span = stats.span();
+                    self.simplify(p, &blocks, &branches, id, &mut executor, stats)
+                        .await;
+                    stats.end(Stage::Simplify, span);
+                }
+            }
+
+            if let Some(p) = self.recheck.pop().await {
+                let span = stats.span();
+                self.recheck(p, &mut executor, &mut hits, stats).await;
+                stats.end(Stage::Triage, span);
+            }
+
+            let span = stats.span();
+            let p = self.get_prog(&mut gen_cnt, &mut strs).await;
+            let gen_time = stats.end(Stage::Gen, span);
+            stats.record_latency(Latency::Gen, gen_time);
+            let (hits, lookups) = strs.take_counts();
+            self.str_hits.fetch_add(hits, Ordering::Relaxed);
+            self.str_lookups.fetch_add(lookups, Ordering::Relaxed);
+
+            let (gid, len) = (p.gid, p.len());
+            let start = Instant::now();
+            let span = stats.span();
+            let exec_result = self.exec(&mut executor, &p, stats, Stage::Exec).await;
+            stats.end(Stage::Exec, span);
+            let gain = match exec_result {
                 Ok(exec_result) => match exec_result {
-                    ExecResult::Ok(raw_branches) => {
-                        self.feedback_analyze(p, raw_branches, &mut executor).await
+                    ExecResult::Ok(raw_branches, truncated) => {
+                        if !truncated.is_empty() {
+                            self.cover_overflows
+                                .fetch_add(truncated.len(), Ordering::Relaxed);
+                        }
+                        strs.extend_with(&p, &self.target);
+                        if let Some(directed) = self.directed.as_ref() {
+                            let dists = directed.distances(&raw_branches);
+                            if directed.record(&p, &dists, &self.target) {
+                                self.touch();
+                            }
+                        }
+                        let span = stats.span();
+                        let gain = self
+                            .feedback_analyze(p, raw_branches, &mut executor, &mut hits, stats)
+                            .await;
+                        stats.end(Stage::Triage, span);
+                        gain
+                    }
+                    ExecResult::Failed(reason) => {
+                        let start = Instant::now();
+                        self.failed_analyze(p, reason).await;
+                        stats.record_latency(Latency::Record, start.elapsed());
+                        0
                     }
-                    ExecResult::Failed(reason) => self.failed_analyze(p, reason).await,
                 },
                 Err(crash) => {
-                    self.crash_analyze(p, crash.unwrap_or_default(), &mut executor)
-                        .await
+                    self.crash_analyze(p, crash.unwrap_or_default(), &mut executor, stats)
+                        .await;
+                    0
                 }
             };
-            self.exec_cnt.fetch_add(1, Ordering::SeqCst);
+            if self.length.record(gid, len, gain, start.elapsed()).await {
+                self.touch();
+            }
+            stats.set_restarts(executor.boots().saturating_sub(1));
         }
     }
 
     pub async fn persist(self) {
-        let corpus_path = "./corpus";
+        self.persist_state().await;
+    }
+
+    /// Persist state every interval until shutdown, so a host crash only loses
+    /// work since last checkpoint. Nothing is written if no persisted state
+    /// changed since last checkpoint.
+    pub async fn checkpoint(self, interval: Duration, mut shutdown: broadcast::Receiver<()>) {
+        let mut last = 0;
+        loop {
+            tokio::select! {
+                _ = shutdown.recv() => return,
+                _ = delay_for(interval) => (),
+            }
+            // Changes made while persisting are left to next checkpoint.
+            let now = self.generation.load(Ordering::Relaxed);
+            if now == last {
+                continue;
+            }
+            let start = Instant::now();
+            self.persist_state().await;
+            last = now;
+            info!(
+                "Checkpoint: corpus {}, cost {}ms",
+                self.corpus.len().await,
+                start.elapsed().as_millis()
+            );
+        }
+    }
+
+    /// Mark persisted state changed.
+    fn touch(&self) {
+        self.generation.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Write corpus, feedback, relations and test cases. State is copied under
+    /// locks and then encoded, each file is replaced atomically, so a crash
+    /// during writing leaves the last complete checkpoint. Corpus changes are
+    /// appended to its log, a torn append is skipped when it's loaded.
+    async fn persist_state(&self) {
+        let _guard = self.persist_lock.lock().await;
         let corpus = self
             .corpus
             .dump()
             .await
             .unwrap_or_else(|e| exits!(exitcode::DATAERR, "Fail to dump corpus: {}", e));
-        write(&corpus_path, corpus).await.unwrap_or_else(|e| {
-            exits!(
-                exitcode::IOERR,
-                "Fail to persist corpus to {} : {}",
-                corpus_path,
-                e
-            )
-        });
+        match corpus {
+            Some(Dump::Full(data)) => write_atomic("./corpus", data).await,
+            Some(Dump::Append(data)) => append("./corpus", data).await,
+            None => (),
+        }
+        let feedback = self
+            .feedback
+            .dump(self.edge_mode)
+            .await
+            .unwrap_or_else(|e| exits!(exitcode::DATAERR, "Fail to dump feedback: {}", e));
+        write_atomic("./feedback", feedback).await;
+        let relations = {
+            let rt = self.rt.lock().await;
+            rt.iter()
+                .map(|(gid, r)| (*gid, r.dump_learned()))
+                .collect::<HashMap<_, _>>()
+        };
+        let relations = bincode::serialize(&relations)
+            .unwrap_or_else(|e| exits!(exitcode::DATAERR, "Fail to dump relations: {}", e));
+        write_atomic("./relations", relations).await;
+        let scheduler = SchedulerState {
+            length: self.length.dump().await,
+            directed: self.directed.as_ref().map(|d| d.dump()),
+        };
+        let scheduler = bincode::serialize(&scheduler)
+            .unwrap_or_else(|e| exits!(exitcode::DATAERR, "Fail to dump scheduler: {}", e));
+        write_atomic("./scheduler", scheduler).await;
         self.record.psersist().await;
     }
 
@@ -133,7 +385,21 @@ impl Fuzzer {
         self.record.insert_failed(p, reason).await
     }
 
-    async fn crash_analyze(&self, p: Prog, crash: Crash, executor: &mut Executor) {
+    /// Time of crash handling is counted here, since crash can happen in any stage.
+    async fn crash_analyze(&self, p: Prog, crash: Crash, executor: &mut Executor, stats: &VmStats) {
+        let span = stats.span();
+        stats.inc_crash();
+        self.do_crash_analyze(p, crash, executor, stats).await;
+        stats.end(Stage::Crash, span);
+    }
+
+    async fn do_crash_analyze(
+        &self,
+        p: Prog,
+        crash: Crash,
+        executor: &mut Executor,
+        stats: &VmStats,
+    ) {
         if self.should_ignore(&crash.inner) {
             warn!("Crashed, match ignores, restarting ...");
             executor.start().await;
@@ -153,11 +419,10 @@ impl Fuzzer {
         warn!("Restarting to repro ...");
         executor.start().await;
 
-        self.exec_cnt.fetch_add(1, Ordering::SeqCst);
-        match executor.exec(&p, &self.target).await {
+        match self.exec(executor, &p, stats, Stage::Crash).await {
             Ok(exec_result) => {
                 match exec_result {
-                    ExecResult::Ok(_) => warn!("Repo failed, executed successfully"),
+                    ExecResult::Ok(..) => warn!("Repo failed, executed successfully"),
                     ExecResult::Failed(reason) => warn!("Repo failed, executed failed: {}", reason),
                 };
                 self.record.insert_crash(p, crash, false).await
@@ -191,28 +456,77 @@ impl Fuzzer {
             return true;
         }
 
-        let digest = md5::compute(reason);
-        let mut g = self.crash_digests.lock().await;
-        !g.insert(digest)
+        let mut db = self.crash_db.lock().await;
+        let (id, known) = db.record(reason).await;
+        if known {
+            let b = db.get(id).unwrap();
+            warn!(
+                "Crash bucket {} \"{}\": {} hits since {}",
+                b.id,
+                b.title,
+                b.hits,
+                b.first_seen.format("%Y-%m-%d %H:%M:%S")
+            );
+        }
+        known
+    }
+
+    /// Re-execute prog of restored corpus. Its seed slots are refreshed if its last
+    /// call still covers something, otherwise it's dropped from corpus, e.g. the
+    /// kernel changed since last run.
+    async fn recheck(
+        &self,
+        p: Prog,
+        executor: &mut Executor,
+        hits: &mut HitCounter,
+        stats: &VmStats,
+    ) {
+        let raw_branches = match self.exec_no_crash(executor, &p, stats, Stage::Triage).await {
+            ExecResult::Ok(raw_branches, _) => raw_branches,
+            ExecResult::Failed(_) => Vec::new(),
+        };
+        let reproduced = raw_branches.len() == p.len()
+            && raw_branches.last().map(|b| !b.is_empty()).unwrap_or(false);
+        if !reproduced {
+            if self.corpus.remove(&p).await {
+                self.touch();
+                warn!("Recheck: coverage not reproduced, prog dropped from corpus");
+            }
+            return;
+        }
+
+        let (blocks, _) = self.cook_raw_block(raw_branches.last().unwrap(), None);
+        let slots = self.feedback.rarest(&blocks, SEED_SLOTS);
+        let dist = self.prog_distance(&raw_branches);
+        self.corpus.insert(p.clone(), slots, dist).await;
+        // Coverage may differ from last run, new part of it is triaged as usual.
+        self.feedback_analyze(p, raw_branches, executor, hits, stats)
+            .await;
     }
 
+    /// Return number of new blocks and branches merged into feedback.
     async fn feedback_analyze(
         &self,
         p: Prog,
         raw_blocks: Vec<Vec<usize>>,
         executor: &mut Executor,
-    ) {
+        hits: &mut HitCounter,
+        stats: &VmStats,
+    ) -> usize {
+        let mut gain = 0;
         for (call_index, raw_blocks) in raw_blocks.iter().enumerate() {
-            let (new_blocks_1, new_branches_1) = self.check_new_feedback(raw_blocks).await;
+            let (new_blocks_1, new_branches_1, new_hits_1) =
+                self.check_new_feedback(raw_blocks, hits, true, stats).await;
 
-            if !new_blocks_1.is_empty() || !new_branches_1.is_empty() {
+            if !new_blocks_1.is_empty() || !new_branches_1.is_empty() || new_hits_1.is_some() {
                 let p = p.sub_prog(call_index);
-                let exec_result = self.exec_no_crash(executor, &p).await;
+                let exec_result = self.exec_no_crash(executor, &p, stats, Stage::Triage).await;
 
-                if let ExecResult::Ok(raw_blocks) = exec_result {
+                if let ExecResult::Ok(raw_blocks, _) = exec_result {
                     if raw_blocks.len() == call_index + 1 {
-                        let (new_block_2, new_branches_2) =
-                            self.check_new_feedback(&raw_blocks[call_index]).await;
+                        let (new_block_2, new_branches_2, new_hits_2) = self
+                            .check_new_feedback(&raw_blocks[call_index], hits, false, stats)
+                            .await;
 
                         let new_block: HashSet<_> =
                             new_blocks_1.intersection(&new_block_2).cloned().collect();
@@ -221,19 +535,33 @@ impl Fuzzer {
                             .cloned()
                             .collect();
 
-                        if !new_block.is_empty() || !new_branches.is_empty() {
-                            let minimized_p = self.minimize(&p, &new_block, executor).await;
-                            let raw_branches = self.exec_no_fail(executor, &minimized_p).await;
-                            {
+                        // New bucket must be stable too, only buckets of second run are kept.
+                        let new_hits = new_hits_1.and(new_hits_2);
+
+                        if !new_block.is_empty() || !new_branches.is_empty() || new_hits.is_some() {
+                            let span = stats.span();
+                            // Only new blocks are checked by minimization, a prog gaining
+                            // just branches or hit buckets is kept as is and learns nothing.
+                            let minimized_p = if new_block.is_empty() {
+                                p.clone()
+                            } else {
+                                let minimized_p =
+                                    self.minimize(&p, &new_block, executor, stats).await;
                                 let g = &self.target.groups[&p.gid];
                                 let mut r = self.rt.lock().await;
-                                prog_analyze(g, r.get_mut(&p.gid).unwrap(), &p);
-                            }
+                                prog_analyze(g, r.get_mut(&p.gid).unwrap(), &minimized_p);
+                                self.touch();
+                                minimized_p
+                            };
+                            let raw_branches = self
+                                .exec_no_fail(executor, &minimized_p, stats, Stage::Minimize)
+                                .await;
+                            stats.end(Stage::Minimize, span);
 
                             let mut blocks = Vec::new();
                             let mut branches = Vec::new();
                             for raw_branches in raw_branches.iter() {
-                                let (block, branch) = self.cook_raw_block(raw_branches);
+                                let (block, branch) = self.cook_raw_block(raw_branches, None);
                                 blocks.push(block);
                                 branches.push(branch);
                             }
@@ -241,7 +569,9 @@ impl Fuzzer {
                             blocks.shrink_to_fit();
                             branches.shrink_to_fit();
 
-                            self.record
+                            let start = Instant::now();
+                            let id = self
+                                .record
                                 .insert_executed(
                                     &minimized_p,
                                     &blocks[..],
@@ -250,20 +580,47 @@ impl Fuzzer {
                                     &new_branches,
                                 )
                                 .await;
-                            self.corpus.insert(minimized_p).await;
+                            stats.record_latency(Latency::Record, start.elapsed());
+                            let slots = blocks
+                                .last()
+                                .map(|b| self.feedback.rarest(b, SEED_SLOTS))
+                                .unwrap_or_default();
+                            let dist = self.prog_distance(&raw_branches);
+                            if self.corpus.insert(minimized_p.clone(), slots, dist).await
+                                && (!new_block.is_empty() || !new_branches.is_empty())
+                            {
+                                self.simplify_queue
+                                    .push((
+                                        minimized_p,
+                                        new_block.clone(),
+                                        new_branches.clone(),
+                                        id,
+                                    ))
+                                    .await;
+                            }
+                            gain += new_block.len() + new_branches.len();
                             self.feedback.merge(new_block, new_branches).await;
+                            if let Some(hits) = new_hits {
+                                self.feedback.merge_hits(&hits).await;
+                            }
+                            self.touch();
                         }
                     }
                 }
             }
         }
+        gain
     }
 
+    /// Remove calls of p that last call doesn't need for covering new_block.
+    /// Coverage of each reduced prog is compared with new_block itself rather than
+    /// with feedback, which other vms keep merging into.
     async fn minimize(
         &self,
         p: &Prog,
         new_block: &HashSet<Block>,
         executor: &mut Executor,
+        stats: &VmStats,
     ) -> Prog {
         assert!(!p.calls.is_empty());
 
@@ -278,9 +635,24 @@ impl Fuzzer {
             p_orig = p.clone();
             if !remove(&mut p, i) {
                 i += 1;
-            } else if let ExecResult::Ok(cover) = self.exec_no_crash(executor, &p).await {
-                let (new_blocks_1, _) = self.check_new_feedback(cover.last().unwrap()).await;
-                if new_blocks_1.is_empty() || new_blocks_1.intersection(new_block).count() == 0 {
+            } else if let ExecResult::Ok(cover, _) = self
+                .exec_no_crash(executor, &p, stats, Stage::Minimize)
+                .await
+            {
+                let covered = cover.len() == p.len() && {
+                    let (blocks, _) = self.cook_raw_block(cover.last().unwrap(), None);
+                    new_block.iter().all(|b| blocks.binary_search(b).is_ok())
+                };
+                if !covered {
+                    // Call i alone is needed by last call for coverage the full prog
+                    // reproduced in triage, keep it as evidence of relation. Calls
+                    // removed together with i depend on it, so they tell nothing.
+                    if p_orig.len() - p.len() == 1 {
+                        let g = &self.target.groups[&p_orig.gid];
+                        let mut r = self.rt.lock().await;
+                        removal_analyze(g, r.get_mut(&p_orig.gid).unwrap(), &p_orig, i);
+                        self.touch();
+                    }
                     i += 1;
                     p = p_orig;
                 }
@@ -292,22 +664,117 @@ impl Fuzzer {
         p
     }
 
-    async fn check_new_feedback(&self, raw_blocks: &[usize]) -> (HashSet<Block>, HashSet<Branch>) {
-        let (blocks, branches) = self.cook_raw_block(raw_blocks);
+    /// Simplify values of corpus prog p as long as its last call still covers
+    /// new_block and new_branches, so that it is cheaper to send, compile and mutate.
+    /// Corpus entry and test case id of p are updated with the simplified prog.
+    async fn simplify(
+        &self,
+        p: Prog,
+        new_block: &HashSet<Block>,
+        new_branches: &HashSet<Branch>,
+        id: usize,
+        executor: &mut Executor,
+        stats: &VmStats,
+    ) {
+        let mut simplified = p.clone();
+        let mut simplified_cover = None;
+        let mut n = 0;
+        for _ in 0..SIMPLIFY_MAX_EXEC {
+            let mut candidate = simplified.clone();
+            if !simplify(&mut candidate, &self.target, n) {
+                break;
+            }
+            let cover = match self
+                .exec_no_crash(executor, &candidate, stats, Stage::Simplify)
+                .await
+            {
+                ExecResult::Ok(cover, _) if cover.len() == candidate.len() => cover,
+                _ => {
+                    n += 1;
+                    continue;
+                }
+            };
+            let (blocks, branches): (Vec<_>, Vec<_>) =
+                cover.iter().map(|c| self.cook_raw_block(c, None)).unzip();
+            let (last_blocks, last_branches) = (blocks.last().unwrap(), branches.last().unwrap());
+            let kept = new_block
+                .iter()
+                .all(|b| last_blocks.binary_search(b).is_ok())
+                && new_branches
+                    .iter()
+                    .all(|b| last_branches.binary_search(b).is_ok());
+            if kept {
+                simplified = candidate;
+                simplified_cover = Some((blocks, branches));
+            } else {
+                n += 1;
+            }
+        }
+        if let Some((blocks, branches)) = simplified_cover {
+            let slots = self.feedback.rarest(blocks.last().unwrap(), SEED_SLOTS);
+            if self.corpus.replace(&p, simplified.clone(), slots).await {
+                self.touch();
+                self.record
+                    .update_executed(id, &simplified, &blocks, &branches)
+                    .await;
+            }
+        }
+    }
+
+    /// Return new blocks, new branches and new buckets of call, hits of branches are
+    /// counted with counter of vm. Blocks are counted in seed energy only if it's the
+    /// main exec of prog, re-execs of triage would inflate hits of new blocks.
+    async fn check_new_feedback(
+        &self,
+        raw_blocks: &[usize],
+        hits: &mut HitCounter,
+        main_exec: bool,
+        stats: &VmStats,
+    ) -> (HashSet<Block>, HashSet<Branch>, Option<NewHits>) {
+        let start = Instant::now();
+        let (blocks, branches) = self.cook_raw_block(raw_blocks, Some(&mut *hits));
+        if main_exec {
+            self.feedback.record_hits(&blocks);
+        }
         let new_blocks = self.feedback.diff_block(&blocks[..]).await;
         let new_branches = self.feedback.diff_branch(&branches[..]).await;
-        (new_blocks, new_branches)
+        let new_hits = if self.hitcount {
+            self.feedback.diff_hits(hits).await
+        } else {
+            None
+        };
+        stats.record_latency(Latency::Feedback, start.elapsed());
+        (new_blocks, new_branches, new_hits)
+    }
+
+    /// Distance of closest call of an exec result to targets, seeds are scored by it.
+    fn prog_distance(&self, raw_blocks: &[Vec<usize>]) -> u32 {
+        self.directed
+            .as_ref()
+            .and_then(|d| d.distances(raw_blocks).into_iter().min())
+            .unwrap_or(UNREACHABLE)
     }
 
-    /// calculate branch, return depuped blocks and branches
-    fn cook_raw_block(&self, raw_blocks: &[usize]) -> (Vec<Block>, Vec<Branch>) {
+    /// calculate branch, return depuped blocks and branches. Hits of branches are
+    /// counted with hits if hitcount is enabled. With cover filter, only blocks in
+    /// it and branches leading into it are kept.
+    fn cook_raw_block(
+        &self,
+        raw_blocks: &[usize],
+        hits: Option<&mut HitCounter>,
+    ) -> (Vec<Block>, Vec<Branch>) {
         let mut blocks: Vec<Block> = raw_blocks.iter().map(|b| Block::from(*b)).collect();
-        let mut branches: Vec<Branch> = blocks
-            .iter()
-            .cloned()
-            .tuple_windows()
-            .map(|(b1, b2)| Branch::from((b1, b2)))
-            .collect();
+        let mut branches = Vec::new();
+        edges(raw_blocks, self.edge_mode, &mut branches);
+        if let Some(filter) = self.cover_filter.as_ref() {
+            blocks.retain(|b| filter.contains(b.0));
+            // Branch i ends at pc i + 1 of trace.
+            let mut dst = raw_blocks.iter().skip(1);
+            branches.retain(|_| filter.contains(*dst.next().unwrap()));
+        }
+        if let (true, Some(hits)) = (self.hitcount, hits) {
+            hits.count(&branches);
+        }
 
         blocks.sort();
         blocks.dedup();
@@ -318,47 +785,132 @@ impl Fuzzer {
         (blocks, branches)
     }
 
-    async fn exec_no_crash(&self, executor: &mut Executor, p: &Prog) -> ExecResult {
-        self.exec_cnt.fetch_add(1, Ordering::SeqCst);
-        match executor.exec(p, &self.target).await {
+    /// Exec p in stage, latency of each step of exec is recorded.
+    async fn exec(
+        &self,
+        executor: &mut Executor,
+        p: &Prog,
+        stats: &VmStats,
+        stage: Stage,
+    ) -> Result<ExecResult, Option<Crash>> {
+        stats.inc_exec(stage);
+        let ret = executor.exec(p, &self.target).await;
+        if let Some(timing) = executor.take_timing() {
+            record_timing(stats, &timing);
+        }
+        ret
+    }
+
+    async fn exec_no_crash(
+        &self,
+        executor: &mut Executor,
+        p: &Prog,
+        stats: &VmStats,
+        stage: Stage,
+    ) -> ExecResult {
+        match self.exec(executor, p, stats, stage).await {
             Ok(exec_result) => exec_result,
             Err(crash) => {
-                self.crash_analyze(p.clone(), crash.unwrap_or_default(), executor)
+                self.crash_analyze(p.clone(), crash.unwrap_or_default(), executor, stats)
                     .await;
                 ExecResult::Failed(Reason(String::from("Crashed")))
             }
         }
     }
 
-    async fn exec_no_fail(&self, executor: &mut Executor, p: &Prog) -> Vec<Vec<usize>> {
-        self.exec_cnt.fetch_add(1, Ordering::SeqCst);
-        match executor.exec(p, &self.target).await {
+    async fn exec_no_fail(
+        &self,
+        executor: &mut Executor,
+        p: &Prog,
+        stats: &VmStats,
+        stage: Stage,
+    ) -> Vec<Vec<usize>> {
+        match self.exec(executor, p, stats, stage).await {
             Ok(exec_result) => match exec_result {
-                ExecResult::Ok(raw_branches) => raw_branches,
+                ExecResult::Ok(raw_branches, _) => raw_branches,
                 ExecResult::Failed(_) => Default::default(),
             },
             Err(crash) => {
-                self.crash_analyze(p.clone(), crash.unwrap_or_default(), executor)
+                self.crash_analyze(p.clone(), crash.unwrap_or_default(), executor, stats)
                     .await;
                 Default::default()
             }
         }
     }
 
-    async fn get_prog(&self, gen_cnt: &mut usize) -> Prog {
+    /// Generation config of group gid, interfaces close to targets are preferred.
+    async fn gen_conf(&self, gid: GroupId) -> GenConfig {
+        let mut conf = self.length.conf_of(gid).await;
+        if let Some(directed) = self.directed.as_ref() {
+            conf.call_weights = directed.call_weights(gid);
+        }
+        conf
+    }
+
+    async fn get_prog(&self, gen_cnt: &mut usize, strs: &mut StrPool) -> Prog {
         if let Some(p) = self.candidates.pop().await {
             p
         } else if self.corpus.is_empty().await || *gen_cnt % 100 != 0 {
             *gen_cnt += 1;
             let rt = self.rt.lock().await;
-            gen(&self.target, &rt, &self.conf)
+            let gid = self
+                .directed
+                .as_ref()
+                .and_then(|d| d.choose_group(&rt))
+                .unwrap_or_else(|| choose_group(&rt));
+            let conf = self.gen_conf(gid).await;
+            gen_prog(gid, &rt[&gid], &self.target, strs, &conf)
         } else {
             let rt = {
                 let rt = self.rt.lock().await;
                 rt.clone()
             };
             let corpus = self.corpus.inner.lock().await;
-            mutate(&corpus, &self.target, &rt, &self.conf)
+            let seed = corpus.select(&self.feedback);
+            let conf = self.gen_conf(corpus.progs[seed].gid).await;
+            mutate(
+                &corpus.progs[seed],
+                &*corpus,
+                &self.target,
+                &rt,
+                strs,
+                &conf,
+            )
         }
     }
 }
+
+fn record_timing(stats: &VmStats, t: &ExecTiming) {
+    stats.record_latency(Latency::Send, t.send);
+    stats.record_latency(Latency::Wait, t.wait);
+    let us = |us: u32| Duration::from_micros(u64::from(us));
+    // Compile time is 0 if executor can't tell it from running.
+    if t.executor.compile != 0 {
+        stats.record_latency(Latency::Compile, us(t.executor.compile));
+    }
+    stats.record_latency(Latency::Run, us(t.executor.exec));
+    stats.record_latency(Latency::Cover, us(t.executor.cover));
+}
+
+/// Append data to file at path.
+async fn append(path: &str, data: Vec<u8>) {
+    let mut f = OpenOptions::new()
+        .append(true)
+        .open(path)
+        .await
+        .unwrap_or_else(|e| exits!(exitcode::IOERR, "Fail to open {} : {}", path, e));
+    f.write_all(&data)
+        .await
+        .unwrap_or_else(|e| exits!(exitcode::IOERR, "Fail to persist {} : {}", path, e));
+}
+
+/// Write data to a temporary file and rename it to path.
+async fn write_atomic(path: &str, data: Vec<u8>) {
+    let tmp = format!("{}.tmp", path);
+    write(&tmp, data)
+        .await
+        .unwrap_or_else(|e| exits!(exitcode::IOERR, "Fail to persist {} : {}", tmp, e));
+    rename(&tmp, path)
+        .await
+        .unwrap_or_else(|e| exits!(exitcode::IOERR, "Fail to persist {} : {}", path, e));
+}
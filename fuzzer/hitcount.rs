@@ -0,0 +1,124 @@
+//! Hit count
+//!
+//! AFL style bucketing of branch hit counts. Repeats of each branch in one
+//! call are classified into 8 buckets, one bit per bucket, and stored in a
+//! byte map indexed by slot of branch signal. A call is interesting if it hits
+//! a bucket that has never been seen for that branch before.
+use crate::edge::mix;
+use crate::feedback::Branch;
+
+/// Number of branch slots in map, must be power of 2 and fit in u16 index.
+pub const MAP_SIZE: usize = 1 << 16;
+
+/// Bucket bit of saturated hit count.
+#[inline]
+fn bucket(count: u8) -> u8 {
+    match count {
+        0 => 0,
+        1 => 1,
+        2 => 2,
+        3 => 4,
+        4..=7 => 8,
+        8..=15 => 16,
+        16..=31 => 32,
+        32..=127 => 64,
+        _ => 128,
+    }
+}
+
+/// Slot of branch. Signal of exact edge keeps only the low half of the second
+/// pc in its low bits, so the whole signal is mixed.
+#[inline]
+fn slot(b: &Branch) -> usize {
+    mix(b.0 as u64) as usize & (MAP_SIZE - 1)
+}
+
+/// Every bucket ever seen of each slot.
+#[derive(Clone)]
+pub struct HitMap(Vec<u8>);
+
+impl Default for HitMap {
+    fn default() -> Self {
+        HitMap(vec![0; MAP_SIZE])
+    }
+}
+
+impl HitMap {
+    pub fn merge(&mut self, new: &NewHits) {
+        for &(s, b) in new.0.iter() {
+            self.0[s as usize] |= b;
+        }
+    }
+
+    pub fn as_bytes(&self) -> &[u8] {
+        &self.0
+    }
+
+    pub fn from_bytes(bytes: Vec<u8>) -> Option<Self> {
+        if bytes.len() == MAP_SIZE {
+            Some(HitMap(bytes))
+        } else {
+            None
+        }
+    }
+}
+
+/// Buckets of a call that are not in a HitMap, as (slot, bucket bits) pairs.
+#[derive(Debug, Clone)]
+pub struct NewHits(Vec<(u16, u8)>);
+
+/// Hit counts of calls executed by one vm. Map is allocated once and only slots
+/// touched by the counted call are bucketed, compared and cleared.
+#[derive(Default)]
+pub struct HitCounter {
+    counts: Vec<u8>,
+    touched: Vec<u16>,
+}
+
+impl HitCounter {
+    /// Count branches of a call, repeats must be kept.
+    pub fn count(&mut self, branches: &[Branch]) {
+        if self.counts.is_empty() {
+            self.counts = vec![0; MAP_SIZE];
+        }
+        self.clear();
+        for b in branches {
+            let s = slot(b);
+            let c = &mut self.counts[s];
+            if *c == 0 {
+                self.touched.push(s as u16);
+            }
+            *c = c.saturating_add(1);
+        }
+    }
+
+    /// Buckets of counted call that are not in seen, counts are cleared.
+    pub fn new_hits(&mut self, seen: &HitMap) -> Option<NewHits> {
+        let counts = &self.counts;
+        let new = self
+            .touched
+            .iter()
+            .filter_map(|&s| {
+                let b = bucket(counts[s as usize]);
+                if b & !seen.0[s as usize] != 0 {
+                    Some((s, b))
+                } else {
+                    None
+                }
+            })
+            .collect::<Vec<_>>();
+        self.clear();
+        if new.is_empty() {
+            None
+        } else {
+            Some(NewHits(new))
+        }
+    }
+
+    fn clear(&mut self) {
+        for &s in self.touched.iter() {
+            self.counts[s as usize] = 0;
+        }
+        self.touched.clear();
+    }
+}
@@ -0,0 +1,185 @@
+//! Length control
+//!
+//! Compile and execution time of a prog grows with its length, while extra
+//! calls don't always bring more coverage. For each group, controller records
+//! new coverage and time spent by progs of each length, and moves max length
+//! of generation toward the lengths that find coverage fastest.
+use core::gen::Config;
+use fots::types::GroupId;
+use std::collections::HashMap;
+use std::process::exit;
+use std::time::Duration;
+use tokio::sync::Mutex;
+
+/// Records of a group between two adjustments.
+const ADJUST_INTERVAL: usize = 256;
+/// Change of max length in each adjustment.
+const LEN_STEP: usize = 2;
+/// Change of sp_delta in each adjustment.
+const SP_DELTA_STEP: f64 = 0.05;
+/// Weight of old records kept after each adjustment.
+const DECAY: f64 = 0.5;
+
+#[derive(Debug, Clone, Deserialize)]
+pub struct GenConf {
+    pub prog_min_len: Option<usize>,
+    /// Max length progs start with.
+    pub prog_max_len: Option<usize>,
+    /// Bound of max length when adjusted.
+    pub prog_len_limit: Option<usize>,
+    pub sp_delta: Option<f64>,
+    /// Adjust max length and sp_delta online.
+    pub adaptive: Option<bool>,
+}
+
+impl GenConf {
+    pub fn check(&self) {
+        let conf = Config::default();
+        let min_len = self.prog_min_len.unwrap_or(conf.prog_min_len);
+        let max_len = self.prog_max_len.unwrap_or(conf.prog_max_len);
+        let limit = self.prog_len_limit.unwrap_or_else(|| max_len * 2);
+        if min_len == 0 || min_len > max_len || max_len > limit {
+            eprintln!(
+                "Config Error: invalid prog length, 0 < prog_min_len({}) <= prog_max_len({}) <= prog_len_limit({}) required",
+                min_len, max_len, limit
+            );
+            exit(exitcode::CONFIG)
+        }
+        if let Some(sp_delta) = self.sp_delta {
+            if sp_delta <= 0.0 || sp_delta >= 1.0 {
+                eprintln!(
+                    "Config Error: invalid sp_delta {}, sp_delta must between (0,1)",
+                    sp_delta
+                );
+                exit(exitcode::CONFIG)
+            }
+        }
+    }
+}
+
+pub struct LenControl {
+    base: Config,
+    limit: usize,
+    adaptive: bool,
+    groups: Mutex<HashMap<GroupId, LenStat>>,
+}
+
+/// Records and adjusted config of a group, persisted with scheduler state.
+#[derive(Clone, Serialize, Deserialize)]
+pub struct LenStat {
+    /// New coverage found by progs of each length.
+    gain: Vec<f64>,
+    /// Seconds spent by progs of each length.
+    cost: Vec<f64>,
+    records: usize,
+    max_len: usize,
+    sp_delta: f64,
+}
+
+impl LenControl {
+    pub fn new(conf: Option<&GenConf>) -> Self {
+        let mut base = Config::default();
+        let mut limit = base.prog_max_len * 2;
+        let mut adaptive = true;
+        if let Some(conf) = conf {
+            base.prog_min_len = conf.prog_min_len.unwrap_or(base.prog_min_len);
+            base.prog_max_len = conf.prog_max_len.unwrap_or(base.prog_max_len);
+            base.sp_delta = conf.sp_delta.unwrap_or(base.sp_delta);
+            limit = conf.prog_len_limit.unwrap_or(base.prog_max_len * 2);
+            adaptive = conf.adaptive.unwrap_or(true);
+        }
+        Self {
+            base,
+            limit,
+            adaptive,
+            groups: Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// Generation config of group gid.
+    pub async fn conf_of(&self, gid: GroupId) -> Config {
+        let mut conf = self.base.clone();
+        if self.adaptive {
+            let groups = self.groups.lock().await;
+            if let Some(s) = groups.get(&gid) {
+                conf.prog_max_len = s.max_len;
+                conf.sp_delta = s.sp_delta;
+            }
+        }
+        conf
+    }
+
+    /// Record new coverage found by prog of len calls of group gid in cost time,
+    /// return whether config of the group is adjusted.
+    pub async fn record(&self, gid: GroupId, len: usize, gain: usize, cost: Duration) -> bool {
+        if !self.adaptive || len == 0 {
+            return false;
+        }
+        let mut groups = self.groups.lock().await;
+        let s = groups.entry(gid).or_insert_with(|| LenStat {
+            gain: vec![0.0; self.limit + 1],
+            cost: vec![0.0; self.limit + 1],
+            records: 0,
+            max_len: self.base.prog_max_len,
+            sp_delta: self.base.sp_delta,
+        });
+        let len = len.min(self.limit);
+        s.gain[len] += gain as f64;
+        s.cost[len] += cost.as_secs_f64();
+        s.records += 1;
+        if s.records % ADJUST_INTERVAL == 0 {
+            s.adjust(self.base.prog_min_len, self.limit);
+            true
+        } else {
+            false
+        }
+    }
+
+    pub async fn dump(&self) -> HashMap<GroupId, LenStat> {
+        let groups = self.groups.lock().await;
+        groups.clone()
+    }
+
+    /// Restore state of last run. States recorded with another length limit are
+    /// dropped, max length is kept within current bounds.
+    pub async fn restore(&self, state: HashMap<GroupId, LenStat>) {
+        let mut groups = self.groups.lock().await;
+        for (gid, mut s) in state {
+            if s.gain.len() != self.limit + 1 || s.cost.len() != self.limit + 1 {
+                continue;
+            }
+            s.max_len = s.max_len.max(self.base.prog_min_len).min(self.limit);
+            groups.insert(gid, s);
+        }
+    }
+}
+
+impl LenStat {
+    /// Grow max length if the longest progs find coverage fastest, shrink it if
+    /// short ones do. sp_delta follows, so longer progs get more dependent calls.
+    fn adjust(&mut self, min_len: usize, limit: usize) {
+        let best = (1..self.gain.len())
+            .filter(|&l| self.cost[l] > 0.0)
+            .map(|l| (l, self.gain[l] / self.cost[l]))
+            .fold(None, |best: Option<(usize, f64)>, (l, rate)| match best {
+                Some((_, best_rate)) if best_rate >= rate => best,
+                _ => Some((l, rate)),
+            });
+
+        if let Some((best_len, rate)) = best {
+            if rate > 0.0 {
+                if best_len + self.max_len / 4 >= self.max_len {
+                    self.max_len = (self.max_len + LEN_STEP).min(limit);
+                    self.sp_delta = (self.sp_delta + SP_DELTA_STEP).min(0.9);
+                } else if best_len < self.max_len / 2 {
+                    self.max_len = self.max_len.saturating_sub(LEN_STEP).max(min_len);
+                    self.sp_delta = (self.sp_delta - SP_DELTA_STEP).max(0.1);
+                }
+            }
+        }
+
+        for v in self.gain.iter_mut().chain(self.cost.iter_mut()) {
+            *v *= DECAY;
+        }
+    }
+}
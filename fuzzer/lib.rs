@@ -1,3 +1,4 @@
+use std::collections::HashMap;
 use std::path::PathBuf;
 use std::process::{exit, id};
 use std::sync::Arc;
@@ -12,16 +13,24 @@ extern crate log;
 use regex::Regex;
 use tokio::fs::{create_dir_all, read};
 use tokio::signal::ctrl_c;
-use tokio::sync::{broadcast, Barrier};
+use tokio::sync::{broadcast, Barrier, Mutex};
 use tokio::time::{delay_for, Duration, Instant};
 
+use core::analyze::LearnedRelations;
 use core::prog::Prog;
 use core::target::Target;
-use fots::types::Items;
-
-use crate::exec::{Executor, ExecutorConf};
-use crate::fuzzer::Fuzzer;
+use fots::types::{GroupId, Items};
+
+use crate::corpus::Corpus;
+use crate::crash_db::{CrashDb, CRASH_DB_PATH};
+use crate::directed::{Directed, DirectedConf};
+use crate::edge::EdgeMode;
+use crate::exec::{Executor, ExecutorConf, ProbeState, SharedProbe};
+use crate::feedback::FeedBack;
+use crate::filter::FilterConf;
+use crate::fuzzer::{Fuzzer, SchedulerState};
 use crate::guest::{GuestConf, QemuConf, SSHConf};
+use crate::length::GenConf;
 #[cfg(feature = "mail")]
 use crate::mail::MailConf;
 use crate::stats::SamplerConf;
@@ -30,19 +39,40 @@ use crate::stats::SamplerConf;
 #[allow(dead_code)]
 mod utils;
 pub mod corpus;
+mod crash_db;
+mod directed;
+pub mod edge;
 mod exec;
 pub mod feedback;
+mod filter;
 mod fuzzer;
 mod guest;
+pub mod hitcount;
+mod length;
 #[cfg(feature = "mail")]
 mod mail;
 pub mod report;
 mod stats;
 
+/// Minutes between two checkpoints by default.
+const DEFAULT_CHECKPOINT_INTERVAL: u64 = 10;
+
 #[derive(Debug, Clone, Deserialize)]
 pub struct Config {
     pub fots_bin: PathBuf,
     pub curpus: Option<PathBuf>,
+    /// Coverage persisted with corpus, restored at startup to skip triage of corpus.
+    pub feedback: Option<PathBuf>,
+    /// Ratio of corpus that is still re-executed when feedback is restored.
+    pub recheck_ratio: Option<f64>,
+    /// How branch signal is computed from pc pairs, "hash" or "exact".
+    pub edge_mode: Option<EdgeMode>,
+    /// Treat new hit count bucket of branch as new coverage.
+    pub hitcount: Option<bool>,
+    /// Relations learned by last run.
+    pub relations: Option<PathBuf>,
+    /// Length control and directed progress persisted by last run.
+    pub scheduler: Option<PathBuf>,
     pub vm_num: usize,
     pub suppressions: Option<Vec<String>>,
     pub ignores: Option<Vec<String>>,
@@ -51,6 +81,14 @@ pub struct Config {
     pub ssh: SSHConf,
     pub executor: ExecutorConf,
     pub sampler: Option<SamplerConf>,
+    /// Length of generated progs.
+    pub gen: Option<GenConf>,
+    /// Restrict coverage to some pc ranges, functions or files.
+    pub cover_filter: Option<FilterConf>,
+    /// Drive fuzzing toward target functions or pcs.
+    pub directed: Option<DirectedConf>,
+    /// Minutes between two checkpoints of corpus, feedback, relations and scheduler, 0 disables them.
+    pub checkpoint_interval: Option<u64>,
 
     #[cfg(feature = "mail")]
     pub mail: Option<MailConf>,
@@ -97,6 +135,26 @@ impl Config {
             }
         }
 
+        if let Some(feedback) = &self.feedback {
+            if !feedback.is_file() {
+                eprintln!(
+                    "Config Error: feedback file {} is invalid",
+                    feedback.display()
+                );
+                exit(exitcode::CONFIG)
+            }
+        }
+
+        if let Some(ratio) = self.recheck_ratio {
+            if !(0.0..=1.0).contains(&ratio) {
+                eprintln!(
+                    "Config Error: invalid recheck ratio {}, ratio must between [0,1]",
+                    ratio
+                );
+                exit(exitcode::CONFIG)
+            }
+        }
+
         let cpu_num = num_cpus::get();
         if self.vm_num == 0 || self.vm_num > cpu_num * 8 {
             eprintln!(
@@ -111,6 +169,18 @@ impl Config {
             sampler.check()
         }
 
+        if let Some(gen) = self.gen.as_ref() {
+            gen.check()
+        }
+
+        if let Some(filter) = self.cover_filter.as_ref() {
+            filter.check()
+        }
+
+        if let Some(directed) = self.directed.as_ref() {
+            directed.check()
+        }
+
         #[cfg(feature = "mail")]
         if let Some(mail) = mail.as_ref() {
             mail.check()
@@ -125,7 +195,12 @@ impl Config {
 
 pub async fn fuzz(cfg: Config) {
     let cfg = Arc::new(cfg);
-    let (target, corpus) = tokio::join!(load_target(&cfg), load_corpus(&cfg.curpus));
+    let (target, corpus, feedback, relations) = tokio::join!(
+        load_target(&cfg),
+        load_corpus(&cfg.curpus),
+        load_feedback(&cfg),
+        load_relations(&cfg.relations)
+    );
     check_corpus(&target, &corpus);
     info!("Corpus: {}", corpus.len());
     info!(
@@ -133,8 +208,47 @@ pub async fn fuzz(cfg: Config) {
         target.fns.len(),
         target.groups.len()
     );
+    if let Some(feedback) = feedback.as_ref() {
+        let (blocks, branches) = feedback.len().await;
+        info!(
+            "Feedback restored: blocks {}, branches {}",
+            blocks, branches
+        );
+    }
 
-    let fuzzer = Fuzzer::new(target, corpus, &cfg);
+    let cover_filter = match cfg.cover_filter.as_ref() {
+        Some(conf) => {
+            let filter = conf.build().await;
+            info!("Cover filter: {} pc ranges", filter.len());
+            Some(filter)
+        }
+        None => None,
+    };
+
+    let directed = match cfg.directed.as_ref() {
+        Some(conf) => Some(Directed::build(conf).await),
+        None => None,
+    };
+
+    let crash_db = CrashDb::load(CRASH_DB_PATH).await;
+    if crash_db.len() != 0 {
+        info!("Crash buckets restored: {}", crash_db.len());
+    }
+
+    let fuzzer = Fuzzer::new(
+        target,
+        corpus,
+        feedback,
+        relations,
+        directed,
+        cover_filter,
+        crash_db,
+        &cfg,
+    );
+    if let Some(scheduler) = load_scheduler(&cfg.scheduler).await {
+        fuzzer.restore_scheduler(scheduler).await;
+        info!("Scheduler state restored");
+    }
     info!(
         "Booting {} {}/{} on {} ...",
         cfg.vm_num, cfg.guest.os, cfg.guest.arch, cfg.guest.platform
@@ -149,21 +263,34 @@ pub async fn fuzz(cfg: Config) {
 async fn start_fuzz(fuzzer: Fuzzer, cfg: Arc<Config>) -> broadcast::Sender<()> {
     let (shutdown_tx, shutdown_rx) = broadcast::channel(1);
     let barrier = Arc::new(Barrier::new(cfg.vm_num + 1));
-    for _ in 0..cfg.vm_num {
+    let probe: SharedProbe = Arc::new(Mutex::new(ProbeState::default()));
+    for vm in 0..cfg.vm_num {
         let cfg = cfg.clone();
+        let probe = probe.clone();
         let fuzzer = fuzzer.clone();
         let barrier = barrier.clone();
         let shutdown = shutdown_tx.subscribe();
 
         tokio::spawn(async move {
-            let mut executor = Executor::new(&cfg);
+            let mut executor = Executor::new(&cfg, probe);
             executor.start().await;
+            if let Some(disabled) = executor.disabled() {
+                fuzzer.disable(disabled).await;
+            }
             barrier.wait().await;
-            fuzzer.fuzz(executor, shutdown).await;
+            fuzzer.fuzz(vm, executor, shutdown).await;
         });
     }
     barrier.wait().await;
 
+    let interval = cfg
+        .checkpoint_interval
+        .unwrap_or(DEFAULT_CHECKPOINT_INTERVAL);
+    if interval != 0 {
+        let interval = Duration::from_secs(interval * 60);
+        tokio::spawn(fuzzer.clone().checkpoint(interval, shutdown_tx.subscribe()));
+    }
+
     let stats_source = fuzzer.stats();
     tokio::spawn(async move {
         let mut sampler = stats::Sampler::new(stats_source);
@@ -232,12 +359,72 @@ fn check_corpus(t: &Target, corpus: &[Prog]) {
 async fn load_corpus(path: &Option<PathBuf>) -> Vec<Prog> {
     if let Some(path) = path.as_ref() {
         let data = read(path).await.unwrap();
-        bincode::deserialize(&data).unwrap()
+        Corpus::load(&data).unwrap_or_else(|e| {
+            exits!(
+                exitcode::DATAERR,
+                "Fail to load corpus {}: {}",
+                path.display(),
+                e
+            )
+        })
     } else {
         Vec::new()
     }
 }
 
+async fn load_feedback(cfg: &Config) -> Option<FeedBack> {
+    if let Some(path) = cfg.feedback.as_ref() {
+        let data = read(path).await.unwrap();
+        let mode = cfg.edge_mode.unwrap_or_default();
+        let hitcount = cfg.hitcount.unwrap_or(false);
+        let feedback = FeedBack::load(&data, mode, hitcount).unwrap_or_else(|e| {
+            exits!(
+                exitcode::DATAERR,
+                "Fail to load feedback {}: {}",
+                path.display(),
+                e
+            )
+        });
+        Some(feedback)
+    } else {
+        None
+    }
+}
+
+async fn load_relations(path: &Option<PathBuf>) -> Option<HashMap<GroupId, LearnedRelations>> {
+    if let Some(path) = path.as_ref() {
+        let data = read(path).await.unwrap();
+        let relations = bincode::deserialize(&data).unwrap_or_else(|e| {
+            exits!(
+                exitcode::DATAERR,
+                "Fail to load relations {}: {}",
+                path.display(),
+                e
+            )
+        });
+        Some(relations)
+    } else {
+        None
+    }
+}
+
+async fn load_scheduler(path: &Option<PathBuf>) -> Option<SchedulerState> {
+    if let Some(path) = path.as_ref() {
+        let data = read(path).await.unwrap();
+        let scheduler = bincode::deserialize(&data).unwrap_or_else(|e| {
+            exits!(
+                exitcode::DATAERR,
+                "Fail to load scheduler {}: {}",
+                path.display(),
+                e
+            )
+        });
+        Some(scheduler)
+    } else {
+        None
+    }
+}
+
 async fn load_target(cfg: &Config) -> Target {
     let items = Items::load(&read(&cfg.fots_bin).await.unwrap_or_else(|e| {
         error!("Fail to load fots file: {}", e);
@@ -90,7 +90,7 @@ impl TestCaseRecord {
         branches: &[Vec<Branch>],
         new_block: &HashSet<Block>,
         new_branch: &HashSet<Branch>,
-    ) {
+    ) -> usize {
         let block_num = blocks.iter().map(|blocks| blocks.len()).collect();
         let branch_num = branches.iter().map(|branches| branches.len()).collect();
         let id = self.next_id().await;
@@ -117,6 +117,25 @@ impl TestCaseRecord {
             let mut exec_n = self.normal_num.lock().await;
             *exec_n += 1;
         }
+        id
+    }
+
+    /// Replace prog and coverage of executed case id, e.g. once values of prog are
+    /// simplified. Nothing is done if the case is already evicted.
+    pub async fn update_executed(
+        &self,
+        id: usize,
+        p: &Prog,
+        blocks: &[Vec<Block>],
+        branches: &[Vec<Branch>],
+    ) {
+        let stmts = to_script(&p, &self.target);
+        let mut execs = self.normal.lock().await;
+        if let Some(case) = execs.iter_mut().find(|c| c.meta.id == id) {
+            case.p = stmts.to_string();
+            case.block_num = blocks.iter().map(|blocks| blocks.len()).collect();
+            case.branch_num = branches.iter().map(|branches| branches.len()).collect();
+        }
     }
 
     pub async fn insert_crash(&self, p: Prog, crash: Crash, repo: bool) {
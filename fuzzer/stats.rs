@@ -1,28 +1,230 @@
 use crate::corpus::Corpus;
+use crate::directed::{Directed, UNREACHABLE};
 use crate::feedback::FeedBack;
 #[cfg(feature = "mail")]
 use crate::mail;
 use crate::report::TestCaseRecord;
+use crate::utils::hist::{HistSnapshot, Histogram};
 use crate::utils::queue::CQueue;
 #[cfg(feature = "mail")]
 use lettre_email::EmailBuilder;
 
 use circular_queue::CircularQueue;
+use core::analyze::RTable;
 use core::prog::Prog;
+use fots::types::GroupId;
+use std::collections::{BTreeMap, HashMap};
 use std::process::exit;
-use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
 use std::sync::Arc;
+use std::time::Instant;
 use tokio::fs::write;
-use tokio::sync::broadcast;
+use tokio::sync::{broadcast, Mutex};
 use tokio::time;
 use tokio::time::Duration;
 
+const STAGE_NUM: usize = 6;
+
+/// Stages of fuzzing loop of a vm.
+#[derive(Debug, Clone, Copy)]
+pub enum Stage {
+    /// Generating or mutating prog.
+    Gen,
+    /// Executing generated prog.
+    Exec,
+    /// Re-executing progs with new coverage and adding them to corpus.
+    Triage,
+    Minimize,
+    Simplify,
+    /// Restarting and reproducing after crash.
+    Crash,
+}
+
+const STAGES: [Stage; STAGE_NUM] = [
+    Stage::Gen,
+    Stage::Exec,
+    Stage::Triage,
+    Stage::Minimize,
+    Stage::Simplify,
+    Stage::Crash,
+];
+
+impl Stage {
+    fn name(self) -> &'static str {
+        match self {
+            Stage::Gen => "gen",
+            Stage::Exec => "exec",
+            Stage::Triage => "triage",
+            Stage::Minimize => "minimize",
+            Stage::Simplify => "simplify",
+            Stage::Crash => "crash",
+        }
+    }
+}
+
+const LATENCY_NUM: usize = 8;
+
+/// Steps of an exec and handling of its result, whose latency is recorded.
+#[derive(Debug, Clone, Copy)]
+pub enum Latency {
+    /// Generating or mutating prog.
+    Gen,
+    /// Sending prog to executor.
+    Send,
+    /// Waiting for result after prog is sent.
+    Wait,
+    /// Compiling prog, reported by executor.
+    Compile,
+    /// Running prog, reported by executor.
+    Run,
+    /// Reading coverage, reported by executor.
+    Cover,
+    /// Checking coverage of a call against feedback.
+    Feedback,
+    /// Recording test case.
+    Record,
+}
+
+const LATENCIES: [Latency; LATENCY_NUM] = [
+    Latency::Gen,
+    Latency::Send,
+    Latency::Wait,
+    Latency::Compile,
+    Latency::Run,
+    Latency::Cover,
+    Latency::Feedback,
+    Latency::Record,
+];
+
+impl Latency {
+    fn name(self) -> &'static str {
+        match self {
+            Latency::Gen => "gen",
+            Latency::Send => "send",
+            Latency::Wait => "wait",
+            Latency::Compile => "compile",
+            Latency::Run => "run",
+            Latency::Cover => "cover",
+            Latency::Feedback => "feedback",
+            Latency::Record => "record",
+        }
+    }
+}
+
+/// Timing of a stage started by `VmStats::span`.
+pub struct Span {
+    start: Instant,
+    /// Time recorded by all stages when span started.
+    recorded_us: u64,
+}
+
+/// Counters of one vm. Only the task of the vm writes them, so relaxed adds
+/// are enough, and each block is aligned to cache line, so that vms running on
+/// different cores don't bounce lines of each other.
+#[repr(align(64))]
+#[derive(Default)]
+pub struct VmStats {
+    /// Execs of each stage.
+    execs: [AtomicUsize; STAGE_NUM],
+    /// Microseconds spent in each stage.
+    time_us: [AtomicU64; STAGE_NUM],
+    crashes: AtomicUsize,
+    restarts: AtomicUsize,
+    /// Latency of each step in microseconds.
+    latency: [Histogram; LATENCY_NUM],
+}
+
+impl VmStats {
+    pub fn inc_exec(&self, stage: Stage) {
+        self.execs[stage as usize].fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn execs(&self, stage: Stage) -> usize {
+        self.execs[stage as usize].load(Ordering::Relaxed)
+    }
+
+    pub fn total_execs(&self) -> usize {
+        STAGES.iter().map(|&s| self.execs(s)).sum()
+    }
+
+    /// Start timing a stage. Stages can nest, e.g. minimizing in triage and crash
+    /// in any stage, time of nested stages is only counted in them.
+    pub fn span(&self) -> Span {
+        Span {
+            start: Instant::now(),
+            recorded_us: self.recorded_us(),
+        }
+    }
+
+    /// End timing of stage, return time since span started, nested stages included.
+    pub fn end(&self, stage: Stage, span: Span) -> Duration {
+        let elapsed = span.start.elapsed();
+        let nested = self.recorded_us() - span.recorded_us;
+        let us = (elapsed.as_micros() as u64).saturating_sub(nested);
+        self.time_us[stage as usize].fetch_add(us, Ordering::Relaxed);
+        elapsed
+    }
+
+    fn recorded_us(&self) -> u64 {
+        self.time_us.iter().map(|t| t.load(Ordering::Relaxed)).sum()
+    }
+
+    pub fn record_latency(&self, l: Latency, d: Duration) {
+        self.latency[l as usize].record(d.as_micros() as u64);
+    }
+
+    pub fn inc_crash(&self) {
+        self.crashes.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn set_restarts(&self, n: usize) {
+        self.restarts.store(n, Ordering::Relaxed);
+    }
+
+    fn snapshot(&self) -> VmStat {
+        let execs = |s: Stage| self.execs[s as usize].load(Ordering::Relaxed);
+        VmStat {
+            exec: STAGES.iter().map(|&s| execs(s)).sum(),
+            triage_exec: execs(Stage::Triage),
+            minimize_exec: execs(Stage::Minimize) + execs(Stage::Simplify),
+            crashes: self.crashes.load(Ordering::Relaxed),
+            restarts: self.restarts.load(Ordering::Relaxed),
+            stage_ms: STAGES
+                .iter()
+                .map(|&s| {
+                    (
+                        s.name(),
+                        self.time_us[s as usize].load(Ordering::Relaxed) / 1000,
+                    )
+                })
+                .collect(),
+        }
+    }
+}
+
+#[derive(Debug, Clone, Serialize)]
+pub struct VmStat {
+    pub exec: usize,
+    pub triage_exec: usize,
+    /// Execs of minimizing and simplifying.
+    pub minimize_exec: usize,
+    pub crashes: usize,
+    pub restarts: usize,
+    /// Milliseconds spent in each stage.
+    pub stage_ms: BTreeMap<&'static str, u64>,
+}
+
 pub struct StatSource {
     pub corpus: Arc<Corpus>,
     pub feedback: Arc<FeedBack>,
+    pub rt: Arc<Mutex<HashMap<GroupId, RTable>>>,
     pub candidates: Arc<CQueue<Prog>>,
     pub record: Arc<TestCaseRecord>,
-    pub exec: Arc<AtomicUsize>,
+    pub vms: Arc<Vec<VmStats>>,
+    pub str_hits: Arc<AtomicUsize>,
+    pub str_lookups: Arc<AtomicUsize>,
+    pub cover_overflows: Arc<AtomicUsize>,
+    pub directed: Option<Arc<Directed>>,
 }
 
 #[derive(Debug, Clone, Serialize)]
@@ -30,13 +232,48 @@ pub struct Stats {
     pub corpus: usize,
     pub blocks: usize,
     pub branches: usize,
+    /// Number of learned relations.
+    pub relations: usize,
     pub exec: usize,
+    /// Ratio of string pool lookups that found a string.
+    pub str_hit_rate: f64,
+    /// Calls whose coverage is truncated by full kcov buffer.
+    pub cover_overflow: usize,
+    /// Closest distance to targets reached, if fuzzing is directed.
+    pub min_distance: Option<u32>,
+    /// Targets covered, if fuzzing is directed.
+    pub targets_reached: Option<usize>,
+    /// Latency of each step in last sample interval.
+    pub latency: BTreeMap<&'static str, LatencyStat>,
     // pub gen:usize,
     // pub minimized:usize,
     pub candidates: usize,
     pub normal_case: usize,
     pub failed_case: usize,
     pub crashed_case: usize,
+    pub vms: Vec<VmStat>,
+}
+
+/// Latency of a step in microseconds.
+#[derive(Debug, Clone, Serialize)]
+pub struct LatencyStat {
+    pub count: u64,
+    pub p50: u64,
+    pub p90: u64,
+    pub p99: u64,
+    pub max: u64,
+}
+
+impl From<&HistSnapshot> for LatencyStat {
+    fn from(h: &HistSnapshot) -> Self {
+        Self {
+            count: h.count(),
+            p50: h.percentile(0.5),
+            p90: h.percentile(0.9),
+            p99: h.percentile(0.99),
+            max: h.max(),
+        }
+    }
 }
 
 #[derive(Debug, Clone, Deserialize)]
@@ -73,6 +310,8 @@ impl SamplerConf {
 pub struct Sampler {
     pub source: StatSource,
     pub stats: CircularQueue<Stats>,
+    /// Latency histograms of all vms at last sample.
+    last_latency: Vec<HistSnapshot>,
 }
 
 impl Sampler {
@@ -80,6 +319,7 @@ impl Sampler {
         Self {
             source,
             stats: CircularQueue::with_capacity(1024),
+            last_latency: vec![HistSnapshot::default(); LATENCY_NUM],
         }
     }
     pub async fn sample(
@@ -116,17 +356,47 @@ impl Sampler {
                 self.source.candidates.len(),
                 self.source.record.len()
             );
-            let exec = self.source.exec.load(Ordering::SeqCst);
+            let vms = self
+                .source
+                .vms
+                .iter()
+                .map(VmStats::snapshot)
+                .collect::<Vec<_>>();
+            let exec = vms.iter().map(|v| v.exec).sum::<usize>();
+            let latency = self.sample_latency();
+            let str_hit_rate = {
+                let hits = self.source.str_hits.load(Ordering::Relaxed);
+                let lookups = self.source.str_lookups.load(Ordering::Relaxed);
+                if lookups == 0 {
+                    0.0
+                } else {
+                    hits as f64 / lookups as f64
+                }
+            };
+            let cover_overflow = self.source.cover_overflows.load(Ordering::Relaxed);
+            let directed = self.source.directed.as_ref().map(|d| d.progress());
+            let relations = {
+                let rt = self.source.rt.lock().await;
+                rt.values().map(|r| r.learned_len()).sum()
+            };
 
             let stat = Stats {
                 exec,
+                str_hit_rate,
+                cover_overflow,
+                min_distance: directed
+                    .and_then(|(d, _, _)| if d == UNREACHABLE { None } else { Some(d) }),
+                targets_reached: directed.map(|(_, reached, _)| reached),
+                latency,
                 corpus,
                 blocks,
                 branches,
+                relations,
                 candidates,
                 normal_case,
                 failed_case,
                 crashed_case,
+                vms,
             };
 
             if report_interval <= last_report {
@@ -135,14 +405,44 @@ impl Sampler {
                 last_report = Duration::new(0, 0);
             }
 
-            self.stats.push(stat);
             info!(
-                "exec {}, blocks {}, branches {}, failed {}, crashed {}",
-                exec, blocks, branches, failed_case, crashed_case
+                "exec {}, blocks {}, branches {}, relations {}, str hit {:.2}, cover overflow {}, failed {}, crashed {}",
+                exec, blocks, branches, relations, str_hit_rate, cover_overflow, failed_case, crashed_case
             );
+            log_vms(&stat.vms);
+            log_latency(&stat.latency);
+            self.stats.push(stat);
+            if let Some((min_dist, reached, targets)) = directed {
+                let min_dist = if min_dist == UNREACHABLE {
+                    String::from("-")
+                } else {
+                    min_dist.to_string()
+                };
+                info!(
+                    "directed: min distance {}, targets reached {}/{}",
+                    min_dist, reached, targets
+                );
+            }
         }
     }
 
+    /// Latency of each step since last sample, merged over vms.
+    fn sample_latency(&mut self) -> BTreeMap<&'static str, LatencyStat> {
+        let mut now = vec![HistSnapshot::default(); LATENCY_NUM];
+        for vm in self.source.vms.iter() {
+            for (n, h) in now.iter_mut().zip(vm.latency.iter()) {
+                n.merge(&h.snapshot());
+            }
+        }
+        let latency = LATENCIES
+            .iter()
+            .zip(now.iter().zip(self.last_latency.iter()))
+            .map(|(l, (n, last))| (l.name(), LatencyStat::from(&n.since(last))))
+            .collect();
+        self.last_latency = now;
+        latency
+    }
+
     async fn persist(&self) {
         if self.stats.is_empty() {
             return;
@@ -165,3 +465,53 @@ impl Sampler {
         mail::send(email).await
     }
 }
+
+/// Per vm execs and restarts expose slow or flapping vms, time of all vms in
+/// each stage shows where fuzzing time goes.
+fn log_vms(vms: &[VmStat]) {
+    let execs = vms.iter().map(|v| v.exec.to_string()).collect::<Vec<_>>();
+    let restarts = vms
+        .iter()
+        .map(|v| v.restarts.to_string())
+        .collect::<Vec<_>>();
+    info!(
+        "vm exec [{}], restarts [{}]",
+        execs.join(", "),
+        restarts.join(", ")
+    );
+
+    let mut stage_ms = BTreeMap::new();
+    for v in vms {
+        for (s, ms) in v.stage_ms.iter() {
+            *stage_ms.entry(*s).or_insert(0) += ms;
+        }
+    }
+    let total = stage_ms.values().sum::<u64>();
+    if total != 0 {
+        let stages = STAGES
+            .iter()
+            .map(|s| {
+                let ms = stage_ms.get(s.name()).copied().unwrap_or(0);
+                format!("{} {:.1}%", s.name(), ms as f64 * 100.0 / total as f64)
+            })
+            .collect::<Vec<_>>();
+        info!("stages: {}", stages.join(", "));
+    }
+}
+
+fn log_latency(latency: &BTreeMap<&'static str, LatencyStat>) {
+    let steps = LATENCIES
+        .iter()
+        .filter_map(|l| {
+            let s = latency.get(l.name())?;
+            if s.count == 0 {
+                None
+            } else {
+                Some(format!("{} {}/{}/{}", l.name(), s.p50, s.p99, s.max))
+            }
+        })
+        .collect::<Vec<_>>();
+    if !steps.is_empty() {
+        info!("latency p50/p99/max(us): {}", steps.join(", "));
+    }
+}
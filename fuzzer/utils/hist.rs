@@ -0,0 +1,149 @@
+//! Latency histogram
+//!
+//! Log-linear buckets as HDR histogram does: each power of two range is split
+//! into SUB_BUCKETS linear buckets, so a recorded value is rounded down by less
+//! than 1/SUB_BUCKETS of it. Memory is fixed and recording is one relaxed add.
+use std::sync::atomic::{AtomicU64, Ordering};
+
+const SUB_BITS: u32 = 3;
+const SUB_BUCKETS: usize = 1 << SUB_BITS;
+/// Enough for any u64 value.
+const BUCKETS: usize = (64 - SUB_BITS as usize + 1) * SUB_BUCKETS;
+
+pub struct Histogram {
+    counts: Box<[AtomicU64]>,
+}
+
+impl Default for Histogram {
+    fn default() -> Self {
+        let counts = (0..BUCKETS)
+            .map(|_| AtomicU64::new(0))
+            .collect::<Vec<_>>()
+            .into_boxed_slice();
+        Self { counts }
+    }
+}
+
+impl Histogram {
+    pub fn record(&self, v: u64) {
+        self.counts[index(v)].fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> HistSnapshot {
+        HistSnapshot {
+            counts: self
+                .counts
+                .iter()
+                .map(|c| c.load(Ordering::Relaxed))
+                .collect(),
+        }
+    }
+}
+
+/// Counts of a histogram at some time, snapshots of several histograms can be
+/// merged, and the earlier one subtracted to get counts of an interval.
+#[derive(Debug, Clone, Default)]
+pub struct HistSnapshot {
+    counts: Vec<u64>,
+}
+
+impl HistSnapshot {
+    pub fn merge(&mut self, other: &HistSnapshot) {
+        if self.counts.len() < other.counts.len() {
+            self.counts.resize(other.counts.len(), 0);
+        }
+        for (c, o) in self.counts.iter_mut().zip(other.counts.iter()) {
+            *c += o;
+        }
+    }
+
+    /// Counts recorded since earlier.
+    pub fn since(&self, earlier: &HistSnapshot) -> HistSnapshot {
+        let counts = self
+            .counts
+            .iter()
+            .enumerate()
+            .map(|(i, c)| c.saturating_sub(earlier.counts.get(i).copied().unwrap_or(0)))
+            .collect();
+        HistSnapshot { counts }
+    }
+
+    pub fn count(&self) -> u64 {
+        self.counts.iter().sum()
+    }
+
+    /// Value below which q of recorded values fall, 0 if nothing is recorded.
+    pub fn percentile(&self, q: f64) -> u64 {
+        let total = self.count();
+        if total == 0 {
+            return 0;
+        }
+        let target = ((q * total as f64).ceil() as u64).max(1).min(total);
+        let mut seen = 0;
+        for (i, &c) in self.counts.iter().enumerate() {
+            seen += c;
+            if seen >= target {
+                return value_of(i);
+            }
+        }
+        unreachable!()
+    }
+
+    pub fn max(&self) -> u64 {
+        self.counts
+            .iter()
+            .rposition(|&c| c != 0)
+            .map(value_of)
+            .unwrap_or(0)
+    }
+}
+
+fn index(v: u64) -> usize {
+    if v < SUB_BUCKETS as u64 {
+        v as usize
+    } else {
+        let exp = 63 - v.leading_zeros();
+        let sub = (v >> (exp - SUB_BITS)) as usize & (SUB_BUCKETS - 1);
+        (exp - SUB_BITS + 1) as usize * SUB_BUCKETS + sub
+    }
+}
+
+/// Lower bound of values of bucket i.
+fn value_of(i: usize) -> u64 {
+    if i < SUB_BUCKETS {
+        i as u64
+    } else {
+        let exp = (i / SUB_BUCKETS) as u32 + SUB_BITS - 1;
+        let sub = (i % SUB_BUCKETS) as u64;
+        (SUB_BUCKETS as u64 + sub) << (exp - SUB_BITS)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::utils::hist::{index, value_of, Histogram};
+
+    #[test]
+    fn bucket_bounds() {
+        for &v in &[0, 7, 8, 15, 16, 17, 31, 1000, 123_456_789, u64::max_value()] {
+            let lower = value_of(index(v));
+            assert!(lower <= v && v - lower <= v / 8);
+        }
+    }
+
+    #[test]
+    fn percentile() {
+        let h = Histogram::default();
+        for v in 1..=100 {
+            h.record(v);
+        }
+        let earlier = h.snapshot();
+        h.record(10_000);
+        let s = h.snapshot();
+
+        assert_eq!(s.count(), 101);
+        assert_eq!(s.percentile(0.5), 48);
+        assert_eq!(s.max(), 9216);
+        assert_eq!(s.since(&earlier).count(), 1);
+    }
+}
@@ -1,4 +1,5 @@
 pub mod cli;
+pub mod hist;
 pub mod process;
 pub mod queue;
 pub mod split;
@@ -1,6 +1,6 @@
 use core::prog::Prog;
-use executor::exec::fork_exec;
 use executor::exec::ExecResult;
+use executor::exec::{fork_exec, CovPool};
 use executor::Config;
 use std::fs::read;
 use std::path::PathBuf;
@@ -39,8 +39,13 @@ fn main() {
         memleak_check: settings.memleak_check,
         concurrency: settings.concurrency,
     };
-    match fork_exec(p, &target, &conf) {
-        ExecResult::Ok(covs) => {
+    let (result, times) = fork_exec(p, &target, &conf, &mut CovPool::default());
+    println!(
+        "Compile:{}us,Exec:{}us,Cover:{}us",
+        times.compile, times.exec, times.cover
+    );
+    match result {
+        ExecResult::Ok(covs, truncated) => {
             let mut total = 0;
             let mut each = Vec::new();
             for c in covs.iter() {
@@ -48,7 +53,10 @@ fn main() {
                 each.push(c.len());
             }
 
-            println!("Prog len:{},Total pc:{},Executed:{:?}", len, total, each);
+            println!(
+                "Prog len:{},Total pc:{},Executed:{:?},Truncated:{:?}",
+                len, total, each, truncated
+            );
             exit(exitcode::OK)
         }
         ExecResult::Failed(e) => {
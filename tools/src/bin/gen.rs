@@ -26,7 +26,12 @@ fn main() {
 
     let target = load_target(&settings.items);
     let rt = analyze::static_analyze(&target);
-    let p = gen::gen(&target, &rt, &Default::default());
+    let p = gen::gen(
+        &target,
+        &rt,
+        &mut gen::StrPool::default(),
+        &Default::default(),
+    );
 
     if settings.translate {
         let p = c::to_prog(&p, &target);